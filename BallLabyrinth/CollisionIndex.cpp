@@ -0,0 +1,158 @@
+#include "CollisionIndex.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+StaticObject::StaticObject(
+    float x1, float y1, float x2, float y2, float floorheight, float wallheight, float wallwidth)
+{
+    if (y1 == y2)
+    {
+        if (x1 > x2)
+        {
+            edgepointMin.x = x2;
+            edgepointMax.x = x1 + wallwidth;
+        }
+        else
+        {
+            edgepointMin.x = x1;
+            edgepointMax.x = x2 + wallwidth;
+        }
+
+        edgepointMin.y = y1;
+        edgepointMax.y = y1 + wallwidth;
+    }
+    else if (x1 == x2)
+    {
+        if (y1 > y2)
+        {
+            edgepointMin.y = y2;
+            edgepointMax.y = y1 + wallwidth;
+        }
+        else
+        {
+            edgepointMin.y = y1;
+            edgepointMax.y = y2 + wallwidth;
+        }
+
+        edgepointMin.x = x1;
+        edgepointMax.x = x1 + wallwidth;
+    }
+    edgepointMin.z = floorheight;
+    edgepointMax.z = floorheight + wallheight;
+}
+
+CollisionIndex::CollisionIndex(float cellSize)
+: cellSize(cellSize), gridOrigin(0.0f, 0.0f), cellsX(0), cellsY(0)
+{
+}
+
+void
+CollisionIndex::addWall(const StaticObject& wall)
+{
+    walls.push_back(wall);
+}
+
+void
+CollisionIndex::addTrigger(const TriggerVolume& trigger)
+{
+    triggers.push_back(trigger);
+}
+
+void
+CollisionIndex::build()
+{
+    cellStart.clear();
+    cellItems.clear();
+    if (walls.empty())
+    {
+        cellsX = cellsY = 0;
+        return;
+    }
+
+    glm::vec2 min(walls[0].edgepointMin.x, walls[0].edgepointMin.y);
+    glm::vec2 max(walls[0].edgepointMax.x, walls[0].edgepointMax.y);
+    for (auto& wall : walls)
+    {
+        min.x = std::min(min.x, wall.edgepointMin.x);
+        min.y = std::min(min.y, wall.edgepointMin.y);
+        max.x = std::max(max.x, wall.edgepointMax.x);
+        max.y = std::max(max.y, wall.edgepointMax.y);
+    }
+    gridOrigin = min;
+    cellsX     = std::max(1, static_cast<int>(std::ceil((max.x - min.x) / cellSize)));
+    cellsY     = std::max(1, static_cast<int>(std::ceil((max.y - min.y) / cellSize)));
+
+    // count items per cell first, so the flat item list can be filled without reallocation
+    std::vector<uint32_t> counts(cellsX * cellsY, 0);
+    for (auto& wall : walls)
+    {
+        int x0, y0, x1, y1;
+        cellRange(wall.edgepointMin, wall.edgepointMax, x0, y0, x1, y1);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                counts[y * cellsX + x]++;
+    }
+
+    cellStart.resize(counts.size() + 1);
+    cellStart[0] = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+        cellStart[i + 1] = cellStart[i] + counts[i];
+    cellItems.resize(cellStart.back());
+
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (uint32_t i = 0; i < walls.size(); i++)
+    {
+        int x0, y0, x1, y1;
+        cellRange(walls[i].edgepointMin, walls[i].edgepointMax, x0, y0, x1, y1);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                cellItems[fill[y * cellsX + x]++] = i;
+    }
+}
+
+bool
+CollisionIndex::cellRange(
+    const glm::vec3& min, const glm::vec3& max, int& x0, int& y0, int& x1, int& y1) const
+{
+    x0 = static_cast<int>(std::floor((min.x - gridOrigin.x) / cellSize));
+    y0 = static_cast<int>(std::floor((min.y - gridOrigin.y) / cellSize));
+    x1 = static_cast<int>(std::floor((max.x - gridOrigin.x) / cellSize));
+    y1 = static_cast<int>(std::floor((max.y - gridOrigin.y) / cellSize));
+    if (x1 < 0 || y1 < 0 || x0 >= cellsX || y0 >= cellsY)
+        return false;
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, cellsX - 1);
+    y1 = std::min(y1, cellsY - 1);
+    return true;
+}
+
+size_t
+CollisionIndex::query(const glm::vec3& min, const glm::vec3& max, uint32_t* out, size_t maxOut)
+    const
+{
+    int x0, y0, x1, y1;
+    if (cellStart.empty() || !cellRange(min, max, x0, y0, x1, y1))
+        return 0;
+
+    size_t count = 0;
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            int cell = y * cellsX + x;
+            for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+            {
+                uint32_t wall = cellItems[i];
+                // walls spanning several cells show up more than once, the result list is short
+                if (std::find(out, out + count, wall) != out + count)
+                    continue;
+                if (count == maxOut)
+                    return count;
+                out[count++] = wall;
+            }
+        }
+    }
+    return count;
+}
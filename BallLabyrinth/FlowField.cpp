@@ -0,0 +1,135 @@
+#include "FlowField.hpp"
+#include <algorithm>
+#include <cmath>
+
+#define FLOW_FIELD_MAX_CANDIDATES 32 /**< Maximum number of walls tested per cell border. */
+
+const uint16_t FlowField::unreachable;
+
+FlowField::FlowField() : origin(0.0f, 0.0f), pitch(0.0f), wallwidth(0.0f), columns(0), rows(0) {}
+
+glm::vec2
+FlowField::center(int column, int row) const
+{
+    return origin + glm::vec2(column * pitch, row * pitch) + glm::vec2(0.5f * (pitch + wallwidth));
+}
+
+bool
+FlowField::blocked(const CollisionIndex& index, const glm::vec2& a, const glm::vec2& b, float z)
+    const
+{
+    glm::vec3 min(std::min(a.x, b.x), std::min(a.y, b.y), z);
+    glm::vec3 max(std::max(a.x, b.x), std::max(a.y, b.y), z);
+    uint32_t  candidates[FLOW_FIELD_MAX_CANDIDATES];
+    size_t    count = index.query(min, max, candidates, FLOW_FIELD_MAX_CANDIDATES);
+    for (size_t i = 0; i < count; i++)
+    {
+        const StaticObject& wall = index.getWall(candidates[i]);
+        if (wall.edgepointMin.x <= max.x && wall.edgepointMax.x >= min.x
+            && wall.edgepointMin.y <= max.y && wall.edgepointMax.y >= min.y
+            && wall.edgepointMin.z <= z && wall.edgepointMax.z >= z)
+            return true;
+    }
+    return false;
+}
+
+size_t
+FlowField::build(const CollisionIndex& index,
+                 const glm::vec2&      origin,
+                 const glm::vec2&      size,
+                 float                 wallwidth,
+                 float                 floorheight,
+                 float                 wallheight)
+{
+    this->origin    = origin;
+    this->wallwidth = wallwidth;
+    columns = rows = 0;
+    distance.clear();
+    target.clear();
+
+    // every wall segment spans one cell, the shortest wall gives the grid pitch
+    float z = floorheight + 0.5f * wallheight;
+    pitch   = 0.0f;
+    for (auto& wall : index.getWalls())
+    {
+        if (wall.edgepointMax.z < z)
+            continue;  // floor
+        glm::vec3 extent = wall.edgepointMax - wall.edgepointMin;
+        float     length = std::max(extent.x, extent.y) - wallwidth;
+        if (length > 0.0f && (pitch == 0.0f || length < pitch))
+            pitch = length;
+    }
+    if (pitch <= 0.0f)
+        return 0;
+    columns = static_cast<int>(std::round((size.x - wallwidth) / pitch));
+    rows    = static_cast<int>(std::round((size.y - wallwidth) / pitch));
+    if (columns <= 0 || rows <= 0)
+    {
+        columns = rows = 0;
+        return 0;
+    }
+
+    distance.assign(columns * rows, unreachable);
+    target.resize(columns * rows);
+    const int dx[] = {1, -1, 0, 0};
+    const int dy[] = {0, 0, 1, -1};
+
+    // the ball reaches the goal by leaving the labyrinth through any opening of the outer wall
+    std::vector<int> queue;
+    queue.reserve(columns * rows);
+    for (int row = 0; row < rows; row++)
+        for (int column = 0; column < columns; column++)
+        {
+            target[row * columns + column] = center(column, row);
+            for (int d = 0; d < 4; d++)
+            {
+                int x = column + dx[d], y = row + dy[d];
+                if (x >= 0 && x < columns && y >= 0 && y < rows)
+                    continue;
+                glm::vec2 outside = center(x, y);
+                if (distance[row * columns + column] == unreachable
+                    && !blocked(index, center(column, row), outside, z))
+                {
+                    distance[row * columns + column] = 0;
+                    target[row * columns + column]   = outside;
+                    queue.push_back(row * columns + column);
+                }
+            }
+        }
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        int cell   = queue[head];
+        int column = cell % columns, row = cell / columns;
+        for (int d = 0; d < 4; d++)
+        {
+            int x = column + dx[d], y = row + dy[d];
+            if (x < 0 || x >= columns || y < 0 || y >= rows
+                || distance[y * columns + x] != unreachable
+                || blocked(index, center(column, row), center(x, y), z))
+                continue;
+            distance[y * columns + x] = distance[cell] + 1;
+            target[y * columns + x]   = center(column, row);
+            queue.push_back(y * columns + x);
+        }
+    }
+    return queue.size();
+}
+
+bool
+FlowField::getDirection(const glm::vec3& point, glm::vec2& direction) const
+{
+    if (columns == 0)
+        return false;
+    int column = static_cast<int>(std::floor((point.x - origin.x - 0.5f * wallwidth) / pitch));
+    int row    = static_cast<int>(std::floor((point.y - origin.y - 0.5f * wallwidth) / pitch));
+    if (column < 0 || column >= columns || row < 0 || row >= rows
+        || distance[row * columns + column] == unreachable)
+        return false;
+    glm::vec2 offset = target[row * columns + column] - glm::vec2(point.x, point.y);
+    float     length = glm::length(offset);
+    if (length <= 0.0f)
+        return false;
+    direction = offset / length;
+    return true;
+}
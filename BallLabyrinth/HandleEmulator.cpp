@@ -0,0 +1,518 @@
+#include <boost/asio.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "HandleProtocol.hpp"
+#include "LatencyHistogram.hpp"
+#include "PeriodicTimer.hpp"
+#include "SerialCommunication.hpp"
+
+#define EMULATOR_HANDLES 2         /**< Number of emulated handles. */
+#define EMULATOR_RATE 1000.0       /**< Rate positions are streamed at in Hz, like handle.ino. */
+#define EMULATOR_AMPLITUDE 20.0    /**< Amplitude of the emulated hand movement in mm. */
+#define EMULATOR_FREQUENCY 0.2     /**< Frequency of the emulated hand movement in Hz. */
+#define EMULATOR_MAX_FORCE 8.0     /**< Force at full duty cycle, see motorControl in handle.ino. */
+#define EMULATOR_MOTOR_TIME 0.002  /**< Time constant of the motor in seconds. */
+#define EMULATOR_MASS 0.2          /**< Mass of the handle and the hand holding it in kg. */
+#define EMULATOR_HAND_K 200.0      /**< Stiffness of the hand following its movement in N/m. */
+#define EMULATOR_HAND_DAMPING 4.0  /**< Damping of the hand in Ns/m. */
+#define EMULATOR_UDP_HOST "127.0.0.1" /**< Address the UDP handles listen on. */
+#define BENCH_SECONDS 5.0          /**< Default duration of the benchmark in seconds. */
+#define BENCH_BAUD 500000          /**< Baud rate the benchmark host opens the pty with. */
+#define BENCH_ECHO_TIMEOUT std::chrono::milliseconds(100) /**< Round trip counted as lost. */
+
+/**
+ * Disturbances of the network between host and a handle bridged over UDP.
+ */
+struct NetworkConditions
+{
+    double                    loss;   /**< Probability a datagram is lost. */
+    std::chrono::microseconds jitter; /**< Datagrams are delayed uniformly up to this. */
+
+    NetworkConditions() : loss(0.0), jitter(0) {}
+};
+
+/**
+ * Emulated handle, which speaks the protocol of handle.ino either behind a pseudo terminal, so the
+ * host can open the slave side like the serial port of a Hapkit, or over UDP like a network
+ * bridge, answering the address it last received a frame from.
+ */
+class EmulatedHandle
+{
+private:
+    boost::asio::io_service&              ioService;
+    int                                   slave;  /**< Kept open, so the master never reads EIO. */
+    std::string                           path;   /**< Path of the slave side or udp:HOST:PORT. */
+    boost::asio::posix::stream_descriptor stream; /**< Master side. */
+    boost::asio::ip::udp::socket          socket; /**< Bound socket if bridged over UDP. */
+    boost::asio::ip::udp::endpoint        sender; /**< Sender of the last received datagram. */
+    boost::asio::ip::udp::endpoint        peer;   /**< Host the positions are sent to. */
+    NetworkConditions                     network;
+    std::mt19937                          random; /**< Draws losses and delays of datagrams. */
+    uint8_t                               readBuffer[512];
+    HandleProtocol::Decoder               decoder;
+    bool                                  echo;       /**< Answer every force with a position. */
+    uint16_t                              seq;        /**< Sequence number of the next frame. */
+    bool                                  acked;      /**< A frame was received. */
+    uint16_t                              ackSeq;     /**< Sequence number of the last one. */
+    uint32_t                              ackTime;    /**< Time it was received in us. */
+    double                                force;      /**< Last received force command. */
+    HandleProtocol::LocalModel            model;      /**< Last received local force model. */
+    double                                motorForce; /**< Force the motor applies in N. */
+    double                                position;   /**< Position of the handle in m. */
+    double                                velocity;   /**< Velocity of the handle in m/s. */
+    uint64_t                              forcesReceived;
+    uint64_t                              framesDropped; /**< Frames not sent or lost. */
+
+    void frameReceived(const HandleProtocol::FrameView& frame)
+    {
+        acked   = true;
+        ackSeq  = frame.seq();
+        ackTime = SerialCommunication::timestampUs();
+        if (frame.type() == HandleProtocol::Model)
+            model = frame.localModel();
+        if (frame.type() != HandleProtocol::Force)
+            return;
+        force = frame.value();
+        forcesReceived++;
+        if (echo)
+            send(force);
+    }
+
+    void readStart()
+    {
+        stream.async_read_some(
+            boost::asio::buffer(readBuffer),
+            [this](const boost::system::error_code& error, size_t size) {
+                if (error)
+                    return;
+                decoder.feed(readBuffer, size, [this](const HandleProtocol::FrameView& frame) {
+                    frameReceived(frame);
+                });
+                readStart();
+            });
+    }
+
+    void receiveStart()
+    {  // a datagram holds whole frames, so it is parsed on its own
+        socket.async_receive_from(
+            boost::asio::buffer(readBuffer),
+            sender,
+            [this](const boost::system::error_code& error, size_t size) {
+                if (error == boost::asio::error::operation_aborted)
+                    return;
+                if (!error)
+                {
+                    peer = sender;
+                    HandleProtocol::parse(readBuffer,
+                                          size,
+                                          [this](const HandleProtocol::FrameView& frame) {
+                                              frameReceived(frame);
+                                          });
+                }
+                receiveStart();
+            });
+    }
+
+    void transmit(const uint8_t* frame, size_t size)
+    {  // send a datagram to the host, lost or delayed as configured, which reorders datagrams
+        if (peer == boost::asio::ip::udp::endpoint()
+            || std::uniform_real_distribution<double>(0.0, 1.0)(random) < network.loss)
+        {
+            framesDropped++;
+            return;
+        }
+        boost::system::error_code error;
+        if (network.jitter.count() == 0)
+        {
+            socket.send_to(boost::asio::buffer(frame, size), peer, 0, error);
+            if (error)
+                framesDropped++;
+            return;
+        }
+        auto delay = std::chrono::microseconds(
+            std::uniform_int_distribution<int64_t>(0, network.jitter.count())(random));
+        auto timer    = std::make_shared<boost::asio::steady_timer>(ioService, delay);
+        auto datagram = std::make_shared<std::vector<uint8_t>>(frame, frame + size);
+        auto to       = peer;
+        timer->async_wait([this, timer, datagram, to](const boost::system::error_code& error) {
+            boost::system::error_code ignored;
+            if (!error)
+                socket.send_to(boost::asio::buffer(*datagram), to, 0, ignored);
+        });
+    }
+
+public:
+    /**
+     * Opens a pseudo terminal pair in raw mode.
+     * @param echo If set, every received force is sent back as position right away, which is
+     * used by the benchmark to measure round trips.
+     */
+    EmulatedHandle(boost::asio::io_service& ioService, bool echo)
+    : ioService(ioService)
+    , slave(-1)
+    , stream(ioService)
+    , socket(ioService)
+    , echo(echo)
+    , seq(0)
+    , acked(false)
+    , ackSeq(0)
+    , ackTime(0)
+    , force(0.0)
+    , motorForce(0.0)
+    , position(0.0)
+    , velocity(0.0)
+    , forcesReceived(0)
+    , framesDropped(0)
+    {
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+            throw std::runtime_error(std::string("failed to open pty: ") + std::strerror(errno));
+        path  = ptsname(master);
+        slave = open(path.c_str(), O_RDWR | O_NOCTTY);
+        if (slave < 0)
+            throw std::runtime_error("failed to open " + path + ": " + std::strerror(errno));
+        termios settings;
+        tcgetattr(slave, &settings);
+        cfmakeraw(&settings);
+        tcsetattr(slave, TCSANOW, &settings);
+        // positions are written directly and dropped if the pty is full, like handle.ino does
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        stream.assign(master);
+        readStart();
+    }
+
+    /**
+     * Listens for the host on a UDP port instead.
+     */
+    EmulatedHandle(boost::asio::io_service& ioService,
+                   unsigned short           port,
+                   const NetworkConditions& network)
+    : ioService(ioService)
+    , slave(-1)
+    , stream(ioService)
+    , socket(ioService,
+             boost::asio::ip::udp::endpoint(
+                 boost::asio::ip::address::from_string(EMULATOR_UDP_HOST), port))
+    , network(network)
+    , echo(false)
+    , seq(0)
+    , acked(false)
+    , ackSeq(0)
+    , ackTime(0)
+    , force(0.0)
+    , motorForce(0.0)
+    , position(0.0)
+    , velocity(0.0)
+    , forcesReceived(0)
+    , framesDropped(0)
+    {
+        path = std::string("udp:") + EMULATOR_UDP_HOST + ":" + std::to_string(port);
+        socket.non_blocking(true);
+        receiveStart();
+    }
+
+    ~EmulatedHandle()
+    {
+        if (slave >= 0)
+            close(slave);
+    }
+
+    const std::string& getPath() const { return path; }
+
+    uint64_t getForcesReceived() const { return forcesReceived; }
+
+    uint64_t getFramesDropped() const { return framesDropped; }
+
+    /**
+     * Sends a position frame, which acknowledges the last received frame like handle.ino.
+     * @param value Position in mm.
+     */
+    void send(double value)
+    {
+        uint8_t  frame[HandleProtocol::maxFrameSize];
+        uint32_t timestamp = SerialCommunication::timestampUs();
+        uint16_t ackDelay  = HandleProtocol::noAck;
+        if (acked)
+            ackDelay = static_cast<uint16_t>(
+                std::min<uint32_t>(timestamp - ackTime, HandleProtocol::noAck - 1));
+        size_t size
+            = HandleProtocol::encodePosition(frame, seq++, timestamp, value, ackSeq, ackDelay);
+        if (socket.is_open())
+            transmit(frame, size);
+        else if (write(stream.native_handle(), frame, size) != static_cast<ssize_t>(size))
+            framesDropped++;
+    }
+
+    /**
+     * Returns the force of the local model at a position in mm, like handle.ino renders it.
+     */
+    double getLocalForce(double pos) const
+    {
+        double local = 0.0;
+        if ((model.flags & HandleProtocol::LocalWalls) != 0 && pos > model.wallMax)
+            local += model.wallK * (pos - model.wallMax);
+        else if ((model.flags & HandleProtocol::LocalWalls) != 0 && pos < model.wallMin)
+            local += model.wallK * (pos - model.wallMin);
+        if ((model.flags & HandleProtocol::LocalCenterSpring) != 0
+            && std::abs(pos) > model.centerSpringDead)
+            local += (pos - (pos > 0 ? model.centerSpringDead : -model.centerSpringDead))
+                     * model.centerSpringK;
+        return local;
+    }
+
+    /**
+     * Advances the handle by one time step and sends its position.
+     * @param time Time since the start in seconds, drives the movement of the hand.
+     * @param dt Time step in seconds.
+     * @param dynamics If set, the handle is a mass moved by the hand and the motor, otherwise it
+     * follows the hand exactly and the forces are ignored.
+     */
+    void step(double time, double dt, bool dynamics)
+    {
+        double target
+            = EMULATOR_AMPLITUDE / 1000.0 * std::sin(2.0 * M_PI * EMULATOR_FREQUENCY * time);
+        if (dynamics)
+        {
+            // the motor saturates at full duty cycle and a positive force pushes the handle towards
+            // negative positions, so the springs of HapticForceManager are restoring
+            double command = force + getLocalForce(position * 1000.0);
+            command = std::max(-EMULATOR_MAX_FORCE, std::min(EMULATOR_MAX_FORCE, command));
+            motorForce += (command - motorForce) * std::min(1.0, dt / EMULATOR_MOTOR_TIME);
+            double acceleration = (-motorForce + EMULATOR_HAND_K * (target - position)
+                                   - EMULATOR_HAND_DAMPING * velocity)
+                                  / EMULATOR_MASS;
+            velocity += acceleration * dt;
+            position += velocity * dt;
+        }
+        else
+        {
+            position = target;
+        }
+        send(position * 1000.0);
+    }
+};
+
+/**
+ * Acts as host on the first handle with SerialCommunication, measures the round trip time with one
+ * force in flight at a time and then the throughput with as many frames in flight as possible.
+ * @return Exit code.
+ */
+int
+runBench(EmulatedHandle& handle, double seconds)
+{
+    boost::asio::io_service hostService;
+    SerialStats             stats;
+    std::atomic<int32_t>    lastEcho(0);
+    std::atomic<uint64_t>   echoed(0);
+    SerialCommunication     host(hostService,
+                             BENCH_BAUD,
+                             handle.getPath(),
+                             [&](const HandleProtocol::FrameView& frame) {
+                                 lastEcho.store(static_cast<int32_t>(std::lround(frame.value())),
+                                                std::memory_order_release);
+                                 echoed.fetch_add(1, std::memory_order_relaxed);
+                             },
+                             stats);
+    std::thread hostThread([&]() { hostService.run(); });
+
+    typedef PeriodicTimer::Clock Clock;
+    Clock::duration   half = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(seconds / 2));  // round trips first, then throughput
+    LatencyHistogram  roundTrip;
+    uint64_t          lost = 0;
+    Clock::time_point end  = Clock::now() + half;
+    for (int32_t marker = 1; Clock::now() < end; marker = marker % 1000 + 1)
+    {
+        Clock::time_point sent = Clock::now();
+        host.write(marker);
+        while (lastEcho.load(std::memory_order_acquire) != marker
+               && Clock::now() - sent < BENCH_ECHO_TIMEOUT)
+            std::this_thread::yield();
+        if (lastEcho.load(std::memory_order_acquire) == marker)
+            roundTrip.record(Clock::now() - sent);
+        else
+            lost++;
+    }
+
+    uint64_t          echoedBefore = echoed.load(std::memory_order_relaxed);
+    uint64_t          sentFrames   = 0;
+    uint8_t           payload[4]   = { 0, 0, 0, 0 };
+    Clock::time_point start        = Clock::now();
+    end                            = start + half;
+    while (Clock::now() < end)
+    {
+        if (host.send(HandleProtocol::Force, payload, sizeof(payload)))
+            sentFrames++;
+        else
+            std::this_thread::yield();  // the write queue is full
+    }
+    std::this_thread::sleep_for(BENCH_ECHO_TIMEOUT);  // let the last echoes arrive
+    double elapsed  = std::chrono::duration<double>(Clock::now() - start).count();
+    double received = static_cast<double>(echoed.load(std::memory_order_relaxed) - echoedBefore);
+
+    host.close();
+    hostThread.join();
+
+    roundTrip.print(std::cout, "round trip");
+    std::cout << "round trips lost: " << lost << std::endl;
+    size_t echoSize = HandleProtocol::headerSize + HandleProtocol::positionSize
+                      + HandleProtocol::crcSize;
+    std::cout << "throughput: sent " << sentFrames / elapsed << " frames/s, echoed "
+              << received / elapsed << " frames/s (" << received * echoSize / elapsed << " B/s)"
+              << std::endl;
+    stats.print(std::cout, "bench host", seconds);
+    return 0;
+}
+
+/**
+ * Prints the command line options.
+ */
+void
+printUsage(std::ostream& out, const char* program)
+{
+    out << "usage: " << program << " [options]\n"
+        << "  --handles N       number of emulated handles (default " << EMULATOR_HANDLES << ")\n"
+        << "  --rate N          rate the positions are sent at in Hz (default " << EMULATOR_RATE
+        << ")\n"
+        << "  --dynamics        simulate the motor and a hand holding the handle\n"
+        << "  --bench           measure round trip time and throughput of the serial path\n"
+        << "  --bench-time N    duration of the benchmark in seconds (default " << BENCH_SECONDS
+        << ")\n"
+        << "  --udp PORT        emulate network bridges on " << EMULATOR_UDP_HOST
+        << ", handle N on PORT + N - 1\n"
+        << "  --udp-loss P      drop each datagram with probability P\n"
+        << "  --udp-jitter N    delay each datagram by up to N microseconds\n"
+        << "  --help            print this help" << std::endl;
+}
+
+int
+main(int argc, char* argv[])
+{
+    size_t handleCount = EMULATOR_HANDLES;
+    double rate        = EMULATOR_RATE;
+    bool   dynamics    = false;
+    bool   bench       = false;
+    double benchTime   = BENCH_SECONDS;
+    int    udpPort     = 0;
+    NetworkConditions network;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        try
+        {
+            if (arg == "--handles" && i + 1 < argc)
+                handleCount = std::stoul(argv[++i]);
+            else if (arg == "--rate" && i + 1 < argc)
+                rate = std::stod(argv[++i]);
+            else if (arg == "--dynamics")
+                dynamics = true;
+            else if (arg == "--bench")
+                bench = true;
+            else if (arg == "--bench-time" && i + 1 < argc)
+                benchTime = std::stod(argv[++i]);
+            else if (arg == "--udp" && i + 1 < argc)
+                udpPort = std::stoi(argv[++i]);
+            else if (arg == "--udp-loss" && i + 1 < argc)
+                network.loss = std::stod(argv[++i]);
+            else if (arg == "--udp-jitter" && i + 1 < argc)
+                network.jitter = std::chrono::microseconds(std::stol(argv[++i]));
+            else if (arg == "--help")
+            {
+                printUsage(std::cout, argv[0]);
+                return 0;
+            }
+            else
+            {
+                std::cerr << "unknown argument or missing value: " << arg << std::endl;
+                printUsage(std::cerr, argv[0]);
+                return 1;
+            }
+        }
+        catch (std::exception&)
+        {  // std::stoul and the like throw on values which are no numbers or out of range
+            std::cerr << "invalid value for " << arg << ": " << argv[i] << std::endl;
+            printUsage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    try
+    {
+        boost::asio::io_service                      ioService;
+        std::vector<std::unique_ptr<EmulatedHandle>> handles;
+        for (size_t i = 0; i < (bench ? 1 : handleCount); i++)
+        {
+            if (udpPort > 0 && !bench)  // the benchmark measures the serial path only
+                handles.emplace_back(new EmulatedHandle(
+                    ioService, static_cast<unsigned short>(udpPort + i), network));
+            else
+                handles.emplace_back(new EmulatedHandle(ioService, bench));
+            std::cout << "handle " << i + 1 << ": " << handles.back()->getPath() << std::endl;
+        }
+
+        if (bench)
+        {  // the emulated handle only echoes, its event loop runs beside the benchmark host
+            boost::asio::io_service::work work(ioService);
+            std::thread                   emulatorThread([&]() { ioService.run(); });
+            int                           result = runBench(*handles[0], benchTime);
+            ioService.stop();
+            emulatorThread.join();
+            return result;
+        }
+
+        // stream positions at absolute deadlines until interrupted
+        PeriodicTimer timer(std::chrono::duration_cast<PeriodicTimer::Clock::duration>(
+                                std::chrono::duration<double>(1.0 / rate)),
+                            true);
+        boost::asio::steady_timer stream(ioService);
+        boost::asio::signal_set   signals(ioService, SIGINT, SIGTERM);
+        signals.async_wait([&](const boost::system::error_code&, int) { ioService.stop(); });
+        PeriodicTimer::Clock::time_point start = PeriodicTimer::Clock::now();
+
+        std::function<void(const boost::system::error_code&)> tick;
+        tick = [&](const boost::system::error_code& error) {
+            if (error)
+                return;
+            PeriodicTimer::Clock::time_point now = PeriodicTimer::Clock::now();
+            timer.elapsed(now);
+            double time = std::chrono::duration<double>(now - start).count();
+            for (auto& handle : handles)
+                handle->step(time, 1.0 / rate, dynamics);
+            stream.expires_at(timer.getDeadline());
+            stream.async_wait(tick);
+        };
+        timer.start();
+        stream.expires_at(timer.getDeadline());
+        stream.async_wait(tick);
+        ioService.run();
+
+        timer.getJitter().print(std::cout, "emulator wake-up jitter");
+        for (size_t i = 0; i < handles.size(); i++)
+            std::cout << "handle " << i + 1 << ": forces received "
+                      << handles[i]->getForcesReceived() << ", position frames dropped "
+                      << handles[i]->getFramesDropped() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
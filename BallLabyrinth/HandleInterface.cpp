@@ -1,25 +1,85 @@
 #include "HandleInterface.hpp"
 #include "HapticForceManager.hpp"
-#include "SerialCommunication.hpp"
-#include <boost/lexical_cast.hpp>
+#include "HandleTransport.hpp"
+#include <boost/asio/steady_timer.hpp>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <glm/glm.hpp>
 
-HandleInterface::HandleInterface(size_t baud, const std::string& dev1, const std::string& dev2)
+namespace
+{
+/**
+ * Converts a model in board axis units into the units of a device with the given gain, so the
+ * device renders the same forces as the host would.
+ */
+HandleProtocol::LocalModel
+toDevice(HandleProtocol::LocalModel model, double gain)
+{
+    double wallMin         = model.wallMin / gain;
+    double wallMax         = model.wallMax / gain;
+    model.wallMin          = std::min(wallMin, wallMax);
+    model.wallMax          = std::max(wallMin, wallMax);
+    model.wallK            = model.wallK * gain * gain;
+    model.centerSpringK    = model.centerSpringK * gain * gain;
+    model.centerSpringDead = model.centerSpringDead / std::abs(gain);
+    return model;
+}
+
+int64_t
+toUs(PeriodicTimer::Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+}
+
+HandleInterface::HandleInterface(size_t                           baud,
+                                 const std::vector<Device>&       devices,
+                                 double                           servoRate,
+                                 const RealtimeScheduler::Config& servoRealtime,
+                                 const std::string&               recordPath,
+                                 const std::string&               telemetryPath)
 : quit(false)
 , baud(baud)
-, dev1(dev1)
-, dev2(dev2)
-, force1(0)
-, force2(0)
-, pos1(0)
-, pos2(0)
-, thread(&HandleInterface::run, this)
+, servoRate(servoRate)
+, servoRealtime(servoRealtime)
+, servoTimer(std::chrono::duration_cast<PeriodicTimer::Clock::duration>(
+                 std::chrono::duration<double>(1.0 / servoRate)),
+             true)
+, servoTicks(0)
+, devices(devices)
 , hapticForceManager(nullptr)
 {
+    if (devices.empty() || devices.size() > HANDLE_MAX_DEVICES)
+        throw std::invalid_argument("between 1 and " + std::to_string(HANDLE_MAX_DEVICES)
+                                    + " handle devices are supported");
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (devices[i].axis >= HANDLE_AXES)
+            throw std::invalid_argument("handle " + devices[i].device + " is mapped onto axis "
+                                        + std::to_string(devices[i].axis)
+                                        + ", which does not exist");
+        portStats.emplace_back(new SerialStats());
+        devicePos[i]       = 0.0;
+        sampleTimestamp[i] = 0;
+    }
+    if (!recordPath.empty())
+        recorder.open(recordPath, devices.size());
+    if (!telemetryPath.empty())
+        telemetry.open(telemetryPath);
+    // started last, so the servo loop only sees initialized members
+    thread = std::thread(&HandleInterface::run, this);
 }
 
-HandleInterface::~HandleInterface() { thread.join(); }
+HandleInterface::~HandleInterface() { stop(); }
+
+void
+HandleInterface::stop()
+{
+    quit = true;
+    if (thread.joinable())
+        thread.join();
+}
 
 void
 HandleInterface::run()
@@ -34,106 +94,183 @@ HandleInterface::run()
 #endif
     try
     {
-        boost::asio::io_service ioService1;
-        boost::asio::io_service ioService2;
-        // define an instance of the main class of this program
-        SerialCommunication c1(
-            ioService1,
-            boost::lexical_cast<size_t>(baud),
-            dev1,
-            [this](const char* msg, size_t size) { setPos1(*((int*) msg) / 1000000.0); });
-        SerialCommunication c2(
-            ioService2,
-            boost::lexical_cast<size_t>(baud),
-            dev2,
-            [this](const char* msg, size_t size) { setPos2(*((int*) msg) / 1000000.0); });
-        // run the IO service as a separate thread, so the main thread can block on standard input
-        boost::thread t1(boost::bind(&boost::asio::io_service::run, &ioService1));
-        boost::thread t2(boost::bind(&boost::asio::io_service::run, &ioService2));
-        while (c1.active && c2.active && !quit)  // check the internal state of the connection
-                                                 // to make sure it's still running
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
-            mutex.lock();
-            glm::vec2 force(0.0f, 0.0f);
-            if (hapticForceManager != nullptr)
-                force = hapticForceManager->getHandleForce();
-            c1.write(static_cast<int32_t>(force.x * 1000000));
-            c2.write(static_cast<int32_t>(force.y * 1000000));
-            mutex.unlock();
-        }
-        c1.close();  // close the minicom client connection
-        c2.close();  // close the minicom client connection
-        t1.join();   // wait for the IO service thread to close
-        t2.join();   // wait for the IO service thread to close
+        // all ports and the servo timer are served by this thread, so no locking and no context
+        // switches are needed between receiving positions, computing and sending forces
+        boost::asio::io_service   ioService;
+        boost::asio::steady_timer servo(ioService);
+        auto                      onFrame = [this](size_t device) {
+            return [this, device](const HandleProtocol::FrameView& frame) {
+                if (frame.type() == HandleProtocol::Position)
+                    setPos(device, frame.value(), frame.timestamp());
+            };
+        };
+        std::vector<std::unique_ptr<HandleTransport>> ports;
+        for (size_t i = 0; i < devices.size(); i++)
+            ports.push_back(HandleTransport::open(ioService,
+                                                  static_cast<unsigned int>(baud),
+                                                  devices[i].device,
+                                                  i,
+                                                  onFrame(i),
+                                                  *portStats[i]));
+
+        std::function<void(const boost::system::error_code&)> servoTick;
+        servoTick = [&](const boost::system::error_code& error) {
+            if (error)
+                return;
+            PeriodicTimer::Clock::time_point deadline = servoTimer.getDeadline();
+            PeriodicTimer::Clock::time_point wake     = PeriodicTimer::Clock::now();
+            servoTimer.elapsed(wake);
+            // check the internal state of the connections to make sure they're still running
+            bool active = !quit;
+            for (auto& port : ports)
+                active = active && port->isActive();
+            if (!active)
+            {  // closing the ports ends their pending reads, so the event loop runs out of work
+                for (auto& port : ports)
+                    port->close();
+                return;
+            }
+            servoTicks.fetch_add(1, std::memory_order_relaxed);
+            glm::vec2           force(0.0f, 0.0f);
+            HapticForceManager* manager = hapticForceManager.load(std::memory_order_acquire);
+            HandleProtocol::LocalModel model;
+            if (manager != nullptr && manager->pollLocalModel(PeriodicTimer::Clock::now(), model))
+            {  // the servo loop is the only thread queueing frames, as send() requires
+                uint8_t payload[HandleProtocol::modelSize];
+                for (size_t i = 0; i < ports.size(); i++)
+                {
+                    size_t size = HandleProtocol::writeLocalModel(
+                        payload, toDevice(model, devices[i].gain));
+                    ports[i]->send(HandleProtocol::Model, payload, size);
+                }
+            }
+            HapticSample sample  = HapticSample();
+            bool         tracing = telemetry.isOpen();
+            if (manager != nullptr)
+                force = manager->getHandleForce(tracing ? &sample : nullptr);
+            double axisForce[HANDLE_AXES] = { force.x, force.y };
+            for (size_t i = 0; i < ports.size(); i++)
+            {
+                double deviceForce = axisForce[devices[i].axis] * devices[i].gain;
+                ports[i]->write(deviceForce);
+                recorder.record(HandleProtocol::Force, i, 0, deviceForce);
+            }
+            setForces(axisForce);
+            if (tracing)
+            {  // only copied into the queue here, encoding and writing is left to its thread
+                PeriodicTimer::Clock::time_point sent = PeriodicTimer::Clock::now();
+                sample.timeUs    = toUs(wake.time_since_epoch());
+                sample.lateUs    = static_cast<int32_t>(toUs(wake - deadline));
+                sample.computeUs = static_cast<int32_t>(toUs(sent - wake));
+                telemetry.push(sample);
+            }
+            // absolute expiry, so the time of the tick does not accumulate
+            servo.expires_at(servoTimer.getDeadline());
+            servo.async_wait(servoTick);
+        };
+
+        RealtimeScheduler::apply(servoRealtime, "haptic IO thread");
+        PeriodicTimer::Clock::time_point opened = PeriodicTimer::Clock::now();
+        servoTimer.start();
+        servo.expires_at(servoTimer.getDeadline());
+        servo.async_wait(servoTick);
+        ioService.run();
+
+        double seconds
+            = std::chrono::duration<double>(PeriodicTimer::Clock::now() - opened).count();
+        servoTimer.getJitter().print(std::cout, "haptic servo wake-up jitter");
+        std::cout << "haptic servo missed deadlines: " << servoTimer.getMissedDeadlines() << " of "
+                  << getServoTicks() << " ticks" << std::endl;
+        for (size_t i = 0; i < portStats.size(); i++)
+            portStats[i]->print(std::cout, devices[i].device, seconds);
     }
     catch (std::exception& e)
     {
         std::cerr << "Exception: " << e.what() << "\n";
     }
+    recorder.close();
+    telemetry.close();
 #ifdef POSIX  // restore default buffering of standard input
     tcsetattr(0, TCSANOW, &stored_settings);
 #endif
 }
 
-double
-HandleInterface::getPos1()
+HandleInterface::HandleState
+HandleInterface::getState() const
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    return pos1;
+    return state.load();
 }
 
 double
-HandleInterface::getPos2()
+HandleInterface::getPos(size_t axis) const
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    return pos2;
+    return state.load().pos[axis];
 }
 
 double
-HandleInterface::getForce1()
+HandleInterface::getForce(size_t axis) const
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    return force1;
-}
-
-double
-HandleInterface::getForce2()
-{
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    return force2;
+    return state.load().force[axis];
 }
 
 void
-HandleInterface::setForce1(double force)
+HandleInterface::setForce(size_t axis, double force)
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    force1 = force;
+    state.update([axis, force](HandleState& s) { s.force[axis] = force; });
 }
 
 void
-HandleInterface::setForce2(double force)
+HandleInterface::setForces(const double force[HANDLE_AXES])
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    force2 = force;
+    auto now = PeriodicTimer::Clock::now();
+    state.update([=](HandleState& s) {
+        for (size_t i = 0; i < HANDLE_AXES; i++)
+            s.force[i] = force[i];
+        s.forceTime = now;
+    });
 }
 
 void
-HandleInterface::setPos1(double pos)
+HandleInterface::setPos(size_t device, double pos, uint32_t deviceTimestamp)
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    pos1 = pos;
-}
+    auto   now = PeriodicTimer::Clock::now();
+    double dt  = static_cast<uint32_t>(deviceTimestamp - sampleTimestamp[device]) / 1e6;
+    sampleTimestamp[device] = deviceTimestamp;
+    devicePos[device]       = pos;
+    recorder.record(HandleProtocol::Position, device, deviceTimestamp, pos);
+    deviceEstimates[device] = estimators[device].update(pos, dt, now);
 
-void
-HandleInterface::setPos2(double pos)
-{
-    std::lock_guard<std::recursive_mutex> lock(mutex);
-    pos2 = pos;
+    // average all devices of the axis, which received samples
+    size_t         axis     = devices[device].axis;
+    size_t         count    = 0;
+    double         axisPos  = 0.0;
+    HandleEstimate estimate;
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (devices[i].axis != axis
+            || deviceEstimates[i].time == PeriodicTimer::Clock::time_point())
+            continue;
+        double gain = devices[i].gain;
+        axisPos += gain * devicePos[i];
+        estimate.pos += gain * deviceEstimates[i].pos;
+        estimate.vel += gain * deviceEstimates[i].vel;
+        estimate.acc += gain * deviceEstimates[i].acc;
+        count++;
+    }
+    axisPos /= count;
+    estimate.pos /= count;
+    estimate.vel /= count;
+    estimate.acc /= count;
+    estimate.time = now;
+    state.update([=](HandleState& s) {
+        s.pos[axis]      = axisPos;
+        s.posTime[axis]  = now;
+        s.estimate[axis] = estimate;
+    });
 }
 
 void
 HandleInterface::setHapticForceManager(HapticForceManager* manager)
 {
-    hapticForceManager = manager;
+    hapticForceManager.store(manager, std::memory_order_release);
 }
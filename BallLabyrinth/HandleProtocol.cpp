@@ -0,0 +1,78 @@
+#include "HandleProtocol.hpp"
+#include <cmath>
+
+const double HandleProtocol::valueScale = 1000000.0;
+
+uint16_t
+HandleProtocol::crc16(const uint8_t* data, size_t size)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                                 : static_cast<uint16_t>(crc << 1);
+    }
+    return crc;
+}
+
+size_t
+HandleProtocol::encode(uint8_t*       out,
+                       FrameType      type,
+                       uint16_t       seq,
+                       uint32_t       timestamp,
+                       const uint8_t* payload,
+                       size_t         size)
+{
+    if (size > maxPayload)
+        return 0;
+    out[0] = sync0;
+    out[1] = sync1;
+    out[2] = type;
+    out[3] = static_cast<uint8_t>(size);
+    writeUint16(out + 4, seq);
+    writeUint32(out + 6, timestamp);
+    std::memcpy(out + headerSize, payload, size);
+    writeUint16(out + headerSize + size, crc16(out + 2, headerSize - 2 + size));
+    return headerSize + size + crcSize;
+}
+
+size_t
+HandleProtocol::encodeValue(
+    uint8_t* out, FrameType type, uint16_t seq, uint32_t timestamp, double value)
+{
+    uint8_t payload[4];
+    int32_t fixed = static_cast<int32_t>(std::round(value * valueScale));
+    writeUint32(payload, static_cast<uint32_t>(fixed));
+    return encode(out, type, seq, timestamp, payload, sizeof(payload));
+}
+
+size_t
+HandleProtocol::encodePosition(uint8_t* out,
+                               uint16_t seq,
+                               uint32_t timestamp,
+                               double   position,
+                               uint16_t ackSeq,
+                               uint16_t ackDelay)
+{
+    uint8_t payload[positionSize];
+    int32_t fixed = static_cast<int32_t>(std::round(position * valueScale));
+    writeUint32(payload, static_cast<uint32_t>(fixed));
+    writeUint16(payload + 4, ackSeq);
+    writeUint16(payload + 6, ackDelay);
+    return encode(out, Position, seq, timestamp, payload, sizeof(payload));
+}
+
+size_t
+HandleProtocol::writeLocalModel(uint8_t* payload, const LocalModel& model)
+{
+    double values[] = {
+        model.wallMin, model.wallMax, model.wallK, model.centerSpringK, model.centerSpringDead
+    };
+    for (int i = 0; i < 5; i++)
+        writeUint32(payload + 4 * i,
+                    static_cast<uint32_t>(static_cast<int32_t>(std::round(values[i] * valueScale))));
+    payload[20] = model.flags;
+    return modelSize;
+}
@@ -0,0 +1,151 @@
+#include "HandleRecorder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+const char magic[4] = { 'H', 'R', 'E', 'C' };
+
+int64_t
+nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+}
+
+HandleRecorder::HandleRecorder() : running(false), written(0), dropped(0), lastTimeUs(0) {}
+
+HandleRecorder::~HandleRecorder() { close(); }
+
+bool
+HandleRecorder::open(const std::string& path, size_t deviceCount)
+{
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "cannot create recording " << path << std::endl;
+        return false;
+    }
+    uint8_t header[headerSize];
+    std::copy(magic, magic + 4, header);
+    HandleProtocol::writeUint16(header + 4, version);
+    header[6] = static_cast<uint8_t>(deviceCount);
+    header[7] = 0;
+    file.write(reinterpret_cast<const char*>(header), headerSize);
+
+    lastTimeUs = nowUs();
+    written.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&HandleRecorder::run, this);
+    return true;
+}
+
+void
+HandleRecorder::close()
+{
+    if (!running.exchange(false, std::memory_order_acq_rel))
+        return;
+    writer.join();
+    file.close();
+    std::cout << "recorded " << getWritten() << " handle records, dropped " << getDropped()
+              << std::endl;
+}
+
+void
+HandleRecorder::record(HandleProtocol::FrameType type,
+                       size_t                    device,
+                       uint32_t                  deviceTimestamp,
+                       double                    value)
+{
+    if (!running.load(std::memory_order_relaxed))
+        return;
+    HandleRecord record;
+    record.type            = type;
+    record.device          = static_cast<uint8_t>(device);
+    record.timeUs          = nowUs();
+    record.deviceTimestamp = deviceTimestamp;
+    record.value           = value;
+    if (!queue.push(record))
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void
+HandleRecorder::run()
+{
+    std::vector<uint8_t> buffer;
+    buffer.reserve(RECORDER_QUEUE_SIZE * recordSize);
+    while (running.load(std::memory_order_acquire))
+    {
+        std::this_thread::sleep_for(RECORDER_FLUSH_INTERVAL);
+        flush(buffer);
+    }
+    flush(buffer);  // records queued before close
+}
+
+void
+HandleRecorder::flush(std::vector<uint8_t>& buffer)
+{
+    buffer.clear();
+    HandleRecord record;
+    size_t       count = 0;
+    while (queue.pop(record))
+    {
+        int64_t delta = std::max<int64_t>(record.timeUs - lastTimeUs, 0);
+        lastTimeUs    = record.timeUs;
+        uint8_t bytes[recordSize];
+        bytes[0] = record.type;
+        bytes[1] = record.device;
+        HandleProtocol::writeUint32(bytes + 2,
+                                    static_cast<uint32_t>(std::min<int64_t>(delta, UINT32_MAX)));
+        HandleProtocol::writeUint32(bytes + 6, record.deviceTimestamp);
+        HandleProtocol::writeUint32(bytes + 10,
+                                    static_cast<uint32_t>(static_cast<int32_t>(
+                                        std::round(record.value * HandleProtocol::valueScale))));
+        buffer.insert(buffer.end(), bytes, bytes + recordSize);
+        count++;
+    }
+    if (buffer.empty())
+        return;
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    file.flush();
+    written.store(written.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+bool
+HandleRecorder::load(const std::string&         path,
+                     std::vector<HandleRecord>& records,
+                     size_t*                    deviceCount)
+{
+    std::ifstream        in(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    if (data.size() < headerSize || !std::equal(magic, magic + 4, data.begin())
+        || HandleProtocol::readUint16(data.data() + 4) != version)
+        return false;
+    if (deviceCount != nullptr)
+        *deviceCount = data[6];
+
+    records.clear();
+    records.reserve((data.size() - headerSize) / recordSize);
+    int64_t timeUs = 0;
+    for (size_t pos = headerSize; pos + recordSize <= data.size(); pos += recordSize)
+    {
+        const uint8_t* bytes = data.data() + pos;
+        HandleRecord   record;
+        timeUs += HandleProtocol::readUint32(bytes + 2);
+        record.type            = static_cast<HandleProtocol::FrameType>(bytes[0]);
+        record.device          = bytes[1];
+        record.timeUs          = timeUs;
+        record.deviceTimestamp = HandleProtocol::readUint32(bytes + 6);
+        record.value = static_cast<int32_t>(HandleProtocol::readUint32(bytes + 10))
+                       / HandleProtocol::valueScale;
+        records.push_back(record);
+    }
+    return true;
+}
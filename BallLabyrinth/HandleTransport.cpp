@@ -0,0 +1,48 @@
+#include "HandleTransport.hpp"
+#include "ReplayTransport.hpp"
+#include "SerialCommunication.hpp"
+#include "UdpTransport.hpp"
+#include <cstdint>
+#include <new>
+
+std::unique_ptr<HandleTransport>
+HandleTransport::open(boost::asio::io_service& ioService,
+                      unsigned int             baud,
+                      const std::string&       device,
+                      size_t                   index,
+                      FrameCallback            readCallback,
+                      SerialStats&             stats)
+{
+    const std::string replay = "replay:";
+    const std::string udp    = "udp:";
+    if (device.compare(0, replay.size(), replay) == 0)
+        return std::unique_ptr<HandleTransport>(new ReplayTransport(
+            ioService, device.substr(replay.size()), index, readCallback, stats));
+    size_t portSeparator = device.rfind(':');
+    if (device.compare(0, udp.size(), udp) == 0 && portSeparator >= udp.size())
+        return std::unique_ptr<HandleTransport>(
+            new UdpTransport(ioService,
+                             device.substr(udp.size(), portSeparator - udp.size()),
+                             device.substr(portSeparator + 1),
+                             readCallback,
+                             stats));
+    return std::unique_ptr<HandleTransport>(
+        new SerialCommunication(ioService, baud, device, readCallback, stats));
+}
+
+void*
+HandleTransport::operator new(size_t size)
+{  // over-allocates from the global operator new and keeps the block in front of the aligned start
+    void*     block   = ::operator new(size + HANDLE_TRANSPORT_ALIGNMENT);
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + HANDLE_TRANSPORT_ALIGNMENT)
+                        & ~static_cast<uintptr_t>(HANDLE_TRANSPORT_ALIGNMENT - 1);
+    reinterpret_cast<void**>(aligned)[-1] = block;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void
+HandleTransport::operator delete(void* pointer)
+{
+    if (pointer != nullptr)
+        ::operator delete(static_cast<void**>(pointer)[-1]);
+}
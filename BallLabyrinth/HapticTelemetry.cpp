@@ -0,0 +1,201 @@
+#include "HapticTelemetry.hpp"
+#include "HandleProtocol.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+const char magic[4] = { 'H', 'T', 'E', 'L' };
+
+void
+writeVarint(std::vector<uint8_t>& out, int64_t value)
+{  // zigzag, so small negative differences stay short
+    uint64_t bits = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (bits >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(bits | 0x80));
+        bits >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(bits));
+}
+
+bool
+readVarint(const uint8_t*& data, const uint8_t* end, int64_t& value)
+{
+    uint64_t bits = 0;
+    for (unsigned shift = 0; data < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *data++;
+        bits |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            value = static_cast<int64_t>(bits >> 1) ^ -static_cast<int64_t>(bits & 1);
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+HapticTelemetry::HapticTelemetry() : running(false), written(0), dropped(0), bytes(0)
+{
+    std::fill(previous, previous + fieldCount, 0);
+}
+
+HapticTelemetry::~HapticTelemetry() { close(); }
+
+bool
+HapticTelemetry::open(const std::string& path)
+{
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "cannot create telemetry " << path << std::endl;
+        return false;
+    }
+    uint8_t header[headerSize];
+    std::copy(magic, magic + 4, header);
+    HandleProtocol::writeUint16(header + 4, version);
+    header[6] = TELEMETRY_AXES;
+    header[7] = HapticSample::ComponentCount;
+    file.write(reinterpret_cast<const char*>(header), headerSize);
+
+    std::fill(previous, previous + fieldCount, 0);
+    written.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+    bytes.store(headerSize, std::memory_order_relaxed);
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&HapticTelemetry::run, this);
+    return true;
+}
+
+void
+HapticTelemetry::close()
+{
+    if (!running.exchange(false, std::memory_order_acq_rel))
+        return;
+    writer.join();
+    file.close();
+    uint64_t count = getWritten();
+    std::cout << "haptic telemetry: " << count << " ticks in "
+              << bytes.load(std::memory_order_relaxed) << " bytes ("
+              << (count > 0 ? static_cast<double>(bytes.load(std::memory_order_relaxed)) / count
+                            : 0.0)
+              << " per tick), dropped " << getDropped() << std::endl;
+}
+
+void
+HapticTelemetry::push(const HapticSample& sample)
+{
+    if (!running.load(std::memory_order_relaxed))
+        return;
+    if (!queue.push(sample))
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void
+HapticTelemetry::run()
+{
+    std::vector<uint8_t> buffer;
+    buffer.reserve(TELEMETRY_QUEUE_SIZE * maxSampleSize);
+    while (running.load(std::memory_order_acquire))
+    {
+        std::this_thread::sleep_for(TELEMETRY_FLUSH_INTERVAL);
+        flush(buffer);
+    }
+    flush(buffer);  // samples queued before close
+}
+
+void
+HapticTelemetry::flush(std::vector<uint8_t>& buffer)
+{
+    buffer.clear();
+    HapticSample sample;
+    size_t       count = 0;
+    while (queue.pop(sample))
+    {
+        int64_t fields[fieldCount];
+        toFields(sample, fields);
+        for (size_t i = 0; i < fieldCount; i++)
+        {
+            writeVarint(buffer, fields[i] - previous[i]);
+            previous[i] = fields[i];
+        }
+        count++;
+    }
+    if (buffer.empty())
+        return;
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    file.flush();
+    written.store(written.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    bytes.store(bytes.load(std::memory_order_relaxed) + buffer.size(), std::memory_order_relaxed);
+}
+
+void
+HapticTelemetry::toFields(const HapticSample& sample, int64_t fields[fieldCount])
+{
+    size_t field    = 0;
+    fields[field++] = sample.timeUs;
+    fields[field++] = sample.lateUs;
+    fields[field++] = sample.computeUs;
+    for (size_t axis = 0; axis < TELEMETRY_AXES; axis++)
+    {
+        fields[field++] = std::llround(sample.pos[axis] * TELEMETRY_MOTION_SCALE);
+        fields[field++] = std::llround(sample.vel[axis] * TELEMETRY_MOTION_SCALE);
+        for (size_t component = 0; component < HapticSample::ComponentCount; component++)
+            fields[field++] = std::llround(sample.force[component][axis] * TELEMETRY_FORCE_SCALE);
+        fields[field++] = std::llround(sample.total[axis] * TELEMETRY_FORCE_SCALE);
+    }
+}
+
+void
+HapticTelemetry::fromFields(const int64_t fields[fieldCount], HapticSample& sample)
+{
+    size_t field     = 0;
+    sample.timeUs    = fields[field++];
+    sample.lateUs    = static_cast<int32_t>(fields[field++]);
+    sample.computeUs = static_cast<int32_t>(fields[field++]);
+    for (size_t axis = 0; axis < TELEMETRY_AXES; axis++)
+    {
+        sample.pos[axis] = static_cast<float>(fields[field++] / TELEMETRY_MOTION_SCALE);
+        sample.vel[axis] = static_cast<float>(fields[field++] / TELEMETRY_MOTION_SCALE);
+        for (size_t component = 0; component < HapticSample::ComponentCount; component++)
+            sample.force[component][axis]
+                = static_cast<float>(fields[field++] / TELEMETRY_FORCE_SCALE);
+        sample.total[axis] = static_cast<float>(fields[field++] / TELEMETRY_FORCE_SCALE);
+    }
+}
+
+bool
+HapticTelemetry::load(const std::string& path, std::vector<HapticSample>& samples)
+{
+    std::ifstream        in(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    if (data.size() < headerSize || !std::equal(magic, magic + 4, data.begin())
+        || HandleProtocol::readUint16(data.data() + 4) != version || data[6] != TELEMETRY_AXES
+        || data[7] != HapticSample::ComponentCount)
+        return false;
+
+    samples.clear();
+    int64_t        fields[fieldCount] = {};
+    const uint8_t* pos                = data.data() + headerSize;
+    const uint8_t* end                = data.data() + data.size();
+    while (pos < end)
+    {
+        for (size_t i = 0; i < fieldCount; i++)
+        {
+            int64_t delta;
+            if (!readVarint(pos, end, delta))
+                return true;  // cut off while writing, the complete samples are kept
+            fields[i] += delta;
+        }
+        HapticSample sample;
+        fromFields(fields, sample);
+        samples.push_back(sample);
+    }
+    return true;
+}
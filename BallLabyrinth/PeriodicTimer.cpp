@@ -0,0 +1,63 @@
+#include "PeriodicTimer.hpp"
+#include <thread>
+#include <cerrno>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+PeriodicTimer::PeriodicTimer(Clock::duration period, bool absolute)
+: period(period), absolute(absolute), deadline(Clock::now() + period), missedDeadlines(0)
+{
+}
+
+void
+PeriodicTimer::start()
+{
+    deadline = Clock::now() + period;
+}
+
+PeriodicTimer::Clock::time_point
+PeriodicTimer::wait()
+{
+    if (absolute)
+    {
+#ifdef __linux__
+        // steady_clock is based on CLOCK_MONOTONIC on linux
+        auto     sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline.time_since_epoch());
+        timespec wakeUp;
+        wakeUp.tv_sec  = sinceEpoch.count() / 1000000000;
+        wakeUp.tv_nsec = sinceEpoch.count() % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeUp, nullptr) == EINTR)
+        {
+        }
+#else
+        std::this_thread::sleep_until(deadline);
+#endif
+    }
+    else
+    {
+        deadline = Clock::now() + period;
+        std::this_thread::sleep_for(period);
+    }
+
+    Clock::time_point now = Clock::now();
+    elapsed(now);
+    return now;
+}
+
+void
+PeriodicTimer::elapsed(Clock::time_point now)
+{
+    jitter.record(now - deadline);
+    if (now - deadline >= period)
+    {
+        missedDeadlines++;
+        deadline = now + period;
+    }
+    else
+    {
+        deadline += period;
+    }
+}
@@ -5,45 +5,6 @@
 #include <glm/ext.hpp>
 
 
-Physics::StaticObject::StaticObject(
-    float x1, float y1, float x2, float y2, float floorheight, float wallheight, float wallwidth)
-{
-    if (y1 == y2)
-    {
-        if (x1 > x2)
-        {
-            edgepointMin.x = x2;
-            edgepointMax.x = x1 + wallwidth;
-        }
-        else
-        {
-            edgepointMin.x = x1;
-            edgepointMax.x = x2 + wallwidth;
-        }
-
-        edgepointMin.y = y1;
-        edgepointMax.y = y1 + wallwidth;
-    }
-    else if (x1 == x2)
-    {
-        if (y1 > y2)
-        {
-            edgepointMin.y = y2;
-            edgepointMax.y = y1 + wallwidth;
-        }
-        else
-        {
-            edgepointMin.y = y1;
-            edgepointMax.y = y2 + wallwidth;
-        }
-
-        edgepointMin.x = x1;
-        edgepointMax.x = x1 + wallwidth;
-    }
-    edgepointMin.z = floorheight;
-    edgepointMax.z = floorheight + wallheight;
-}
-
 void
 Physics::Ball::calculateInverseInertiaTensor()
 {
@@ -51,7 +12,7 @@ Physics::Ball::calculateInverseInertiaTensor()
 }
 
 Physics::Collision
-Physics::Ball::collisionCheck(const Physics::StaticObject& wall)
+Physics::Ball::collisionCheck(const StaticObject& wall)
 {
     Collision collision;
     float     x = std::max(wall.edgepointMin.x, std::min(centerpoint.x, wall.edgepointMax.x));
@@ -80,7 +41,7 @@ Physics::Ball::resetPosition(Physics::Collision& collision)
 }
 
 void
-Physics::Ball::updateCollisionImpulse(Physics::Collision& collision)
+Physics::Ball::updateCollisionImpulse(Physics::Collision& collision, bool hapticFeedback)
 {
     auto rBall = -collision.collisionNormal * radius;
 
@@ -94,12 +55,11 @@ Physics::Ball::updateCollisionImpulse(Physics::Collision& collision)
     float j = numerator / denominator;
     velocity += j * collision.collisionNormal / mass;
     auto impulse = j * collision.collisionNormal;
-    if (std::abs(impulse.x * velocity.x) > 0.1f || std::abs(impulse.y * velocity.y) > 0.1f)
+    if (hapticFeedback
+        && (std::abs(impulse.x * velocity.x) > 0.1f || std::abs(impulse.y * velocity.y) > 0.1f))
     {
-        wallCollisionCount = 0;
-        glm::vec2 force(-std::abs(impulse.y) * velocity.y / 10000.0f,
-                        std::abs(impulse.x) * velocity.x / 10000.0f);
-        hapticForceManager.setBallCollisionForce(force);
+        hapticForceManager.pushCollisionImpulse(
+            HapticForceManager::getCollisionForce(impulse, velocity));
     }
     /* std::cout << glm::to_string(impulseXY) << std::endl; */
 
@@ -107,12 +67,8 @@ Physics::Ball::updateCollisionImpulse(Physics::Collision& collision)
 }
 
 void
-Physics::Ball::updatePhysics(float dt, glm::vec3 earthAcceleration)
+Physics::Ball::updatePhysics(float dt, glm::vec3 earthAcceleration, bool updateVisualRotation)
 {
-    if (wallCollisionCount++ > 16)
-    {
-        hapticForceManager.setBallCollisionForce(glm::vec2(0.0f, 0.0f));
-    }
     // calculate rolling resistance
     float forceRoll = rollingFrictionCoefficient * std::abs(earthAcceleration.z) * mass;
 
@@ -166,7 +122,12 @@ Physics::Ball::updatePhysics(float dt, glm::vec3 earthAcceleration)
 
     // Simple calculations to let the ball roll, is just used for update of visual model. It is not
     // used for the physics.
-    if (velocity.x < -0.0001 || velocity.x > 0.0001 || velocity.y < -0.0001 || velocity.y > 0.0001)
+    if (!updateVisualRotation)
+    {
+        rotationAngleSimple = 0.0;
+    }
+    else if (velocity.x < -0.0001 || velocity.x > 0.0001 || velocity.y < -0.0001
+             || velocity.y > 0.0001)
     {
         // omegaSimple = velocity / radius
         glm::vec3 omegaSimple = velocity / radius;
@@ -228,13 +189,54 @@ Physics::Ball::updateGraphicsModel()
     }
 }
 
-Physics::Physics(HapticForceManager& hapticForceManager, float dt)
+Physics::BallState
+Physics::Ball::getState() const
+{
+    BallState state;
+    state.centerpoint              = centerpoint;
+    state.velocity                 = velocity;
+    state.angularMomentum          = angularMomentum;
+    state.omega                    = omega;
+    state.rotationAngleSimple      = rotationAngleSimple;
+    state.rotationAxisSimple       = rotationAxisSimple;
+    state.rotationMatGraphicsModel = rotationMatGraphicsModel;
+    state.rotation                 = rotation;
+    state.inverseInertiaTensor     = inverseInertiaTensor;
+    state.torque                   = torque;
+    return state;
+}
+
+void
+Physics::Ball::setState(const BallState& state)
+{
+    centerpoint              = state.centerpoint;
+    velocity                 = state.velocity;
+    angularMomentum          = state.angularMomentum;
+    omega                    = state.omega;
+    rotationAngleSimple      = state.rotationAngleSimple;
+    rotationAxisSimple       = state.rotationAxisSimple;
+    rotationMatGraphicsModel = state.rotationMatGraphicsModel;
+    rotation                 = state.rotation;
+    inverseInertiaTensor     = state.inverseInertiaTensor;
+    torque                   = state.torque;
+}
+
+Physics::Physics(HapticForceManager&              hapticForceManager,
+                 float                            dt,
+                 const RealtimeScheduler::Config& realtime)
 : hapticForceManager(hapticForceManager)
 , dt(dt)
 , quit(false)
 , earthAcceleration(0.0, 0.0, -EARTH_ACCEL)
 , pitch(0.0)
 , yaw(0.0)
+, collisionIndex(std::make_shared<CollisionIndex>())
+, stepCount(0)
+, watchdog(dt * PHYSICS_STEP_BUDGET)
+, realtime(realtime)
+, timer(std::chrono::duration_cast<PeriodicTimer::Clock::duration>(this->dt), realtime.enabled)
+, snapshots(SNAPSHOT_CAPACITY)
+, contactCount(0)
 {
 }
 
@@ -275,17 +277,54 @@ Physics::addWalls(std::string file)
             {
                 float x1, y1, x2, y2;
                 in >> x1 >> y1 >> x2 >> y2;
-                walls.emplace_back(x1, y1, x2, y2, floorheight, wallheight, wallwidth);
+                collisionIndex->addWall(
+                    StaticObject(x1, y1, x2, y2, floorheight, wallheight, wallwidth));
             }
         }
         myfile.close();
 
-        walls.emplace_back(
+        collisionIndex->addWall(
             StaticObject(startx, starty, startx + widthx, starty, 0.0, floorheight, widthy));
-        std::cout << "walls loaded: " << walls.size() << std::endl;
+        collisionIndex->build();
+        std::cout << "walls loaded: " << collisionIndex->getWalls().size() << std::endl;
+        std::shared_ptr<FlowField> flowField = std::make_shared<FlowField>();
+        size_t                     reachable = flowField->build(*collisionIndex,
+                                                                glm::vec2(startx, starty),
+                                                                glm::vec2(widthx, widthy),
+                                                                wallwidth,
+                                                                floorheight,
+                                                                wallheight);
+        std::cout << "flow field: " << flowField->getColumns() << "x" << flowField->getRows()
+                  << " cells, " << reachable << " with a way out" << std::endl;
+        hapticForceManager.setBoardGeometry(collisionIndex, flowField);
+
+        // The ball reached the goal, as soon as it dropped below the floor outside the labyrinth.
+        const float far = 1000.0f;
+        addTrigger(TriggerVolume::Goal,
+                   0,
+                   glm::vec3(startx + widthx, -far, -far),
+                   glm::vec3(far, far, 0.0f));
+        addTrigger(
+            TriggerVolume::Goal, 0, glm::vec3(-far, -far, -far), glm::vec3(startx, far, 0.0f));
+        addTrigger(TriggerVolume::Goal,
+                   0,
+                   glm::vec3(-far, starty + widthy, -far),
+                   glm::vec3(far, far, 0.0f));
+        addTrigger(
+            TriggerVolume::Goal, 0, glm::vec3(-far, -far, -far), glm::vec3(far, starty, 0.0f));
     }
 }
 
+void
+Physics::addTrigger(TriggerVolume::Type type,
+                    int                 id,
+                    const glm::vec3&    edgepointMin,
+                    const glm::vec3&    edgepointMax)
+{
+    collisionIndex->addTrigger(TriggerVolume(type, id, edgepointMin, edgepointMax));
+    insideTrigger.push_back(false);
+}
+
 void
 Physics::rotateEarthAccelerationXY(float pitch, float yaw)
 {
@@ -298,17 +337,30 @@ Physics::rotateEarthAccelerationXY(float pitch, float yaw)
 }
 
 void
-Physics::handleCollisions()
+Physics::handleCollisions(bool hapticFeedback)
 {
     Collision collision;
     Ball      ball = ballObjects[0];
-    for (auto& wall : walls)
+    uint32_t  candidates[MAX_COLLISION_CANDIDATES];
+    size_t    count = collisionIndex->query(ball.centerpoint - glm::vec3(ball.radius),
+                                        ball.centerpoint + glm::vec3(ball.radius),
+                                        candidates,
+                                        MAX_COLLISION_CANDIDATES);
+    for (size_t i = 0; i < count; i++)
     {
-        collision = ball.collisionCheck(wall);
+        collision = ball.collisionCheck(collisionIndex->getWall(candidates[i]));
         if (collision.collision)
         {
             ballObjects[0].resetPosition(collision);
-            ballObjects[0].updateCollisionImpulse(collision);
+            ballObjects[0].updateCollisionImpulse(collision, hapticFeedback);
+            if (contactCount < SNAPSHOT_MAX_CONTACTS)
+            {
+                Contact& contact        = contacts[contactCount++];
+                contact.ballIndex       = 0;
+                contact.wall            = candidates[i];
+                contact.collisionNormal = collision.collisionNormal;
+                contact.distance        = collision.distance;
+            }
         }
     }
 }
@@ -316,46 +368,198 @@ Physics::handleCollisions()
 void
 Physics::update()
 {
-    auto elapseTime = std::chrono::high_resolution_clock::now();
+    RealtimeScheduler::apply(realtime, "physics thread");
+    timer.start();
+    auto elapseTime = PeriodicTimer::Clock::now();
 
     while (!quit)
     {
-        std::this_thread::sleep_for(dt);
-        dtElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::high_resolution_clock::now() - elapseTime)
-                        .count()
-                    / 1000.0f;
-        elapseTime = std::chrono::high_resolution_clock::now();
-        handleCollisions();
-        lock.lock();
-        ballObjects[0].updatePhysics(dtElapsed, earthAcceleration);
-        //        ballObjects[0].updateGraphicsModel();
-        lock.unlock();
+        auto wakeUp = timer.wait();
+        dtElapsed   = std::chrono::duration<float>(wakeUp - elapseTime).count();
+        elapseTime  = wakeUp;
+        stepMutex.lock();
+        step(readInputs(dtElapsed));
+        stepMutex.unlock();
+        watchdog.record(
+            std::chrono::duration<float>(PeriodicTimer::Clock::now() - wakeUp).count());
     }
+    // after the last step, so no ball of this level is published anymore, the next level brings
+    // its own walls
+    hapticForceManager.setBoardGeometry(nullptr, nullptr);
+
+    timer.getJitter().print(std::cout, "physics wake-up jitter");
+    std::cout << "physics missed deadlines: " << timer.getMissedDeadlines() << std::endl;
+}
+
+Physics::StepInputs
+Physics::readInputs(float stepTime)
+{
+    StepInputs inputs;
+    inputs.dt    = stepTime;
+    inputs.level = watchdog.getLevel();
+    lock.lock();
+    inputs.pitch             = pitch;
+    inputs.yaw               = yaw;
+    inputs.earthAcceleration = earthAcceleration;
+    lock.unlock();
+    return inputs;
 }
 
 void
-Physics::quitPhysics()
+Physics::step(const StepInputs& inputs, bool replay)
 {
+    Snapshot* snapshot = nullptr;
+    if (!replay)
+    {  // every step, resimulating needs the inputs of each one
+        snapshot = &snapshots.capture();
+        captureSnapshot(*snapshot, inputs);
+    }
+    contactCount = 0;
+
+    bool visualRotation = inputs.level < PhysicsWatchdog::NoVisualRotation;
+    bool collisions     = inputs.level < PhysicsWatchdog::CoarseCollisions || stepCount % 2 == 0;
+
+    if (collisions)
+        handleCollisions(!replay);
     lock.lock();
-    quit = true;
+    ballObjects[0].updatePhysics(inputs.dt, inputs.earthAcceleration, visualRotation);
+    //        ballObjects[0].updateGraphicsModel();
     lock.unlock();
+
+    if (snapshot != nullptr)
+    {
+        snapshot->contactCount = contactCount;
+        std::copy(contacts, contacts + contactCount, snapshot->contacts);
+    }
+    if (!replay)
+    {
+        hapticForceManager.publishBall(
+            ballObjects[0].centerpoint, ballObjects[0].velocity, ballObjects[0].radius);
+        handleTriggers();
+    }
+    stepCount++;
 }
 
-bool
-Physics::inGame() const
+void
+Physics::captureSnapshot(Snapshot& snapshot, const StepInputs& inputs)
+{
+    snapshot.step      = stepCount;
+    snapshot.inputs    = inputs;
+    snapshot.ballCount = std::min<size_t>(ballObjects.size(), SNAPSHOT_MAX_BALLS);
+    lock.lock();
+    for (size_t i = 0; i < snapshot.ballCount; i++)
+        snapshot.balls[i] = ballObjects[i].getState();
+    lock.unlock();
+    snapshot.contactCount = 0;
+}
+
+void
+Physics::restoreSnapshot(const Snapshot& snapshot)
 {
     lock.lock();
-    glm::vec3 tmp = ballObjects[0].centerpoint;
+    for (size_t i = 0; i < snapshot.ballCount && i < ballObjects.size(); i++)
+        ballObjects[i].setState(snapshot.balls[i]);
     lock.unlock();
-    if (tmp.x > 15.0 || tmp.x < -15.0 || tmp.y > 15.0 || tmp.y < -15.0)
+    stepCount = snapshot.step;
+
+    // take over the trigger states of the restored position without reporting transitions
+    const std::vector<TriggerVolume>& triggers = collisionIndex->getTriggers();
+    for (size_t i = 0; i < triggers.size(); i++)
+        insideTrigger[i] = triggers[i].contains(ballObjects[0].centerpoint);
+}
+
+uint64_t
+Physics::getStepCount()
+{
+    std::lock_guard<std::mutex> guard(stepMutex);
+    return stepCount;
+}
+
+bool
+Physics::rewind(uint64_t step)
+{
+    std::lock_guard<std::mutex> guard(stepMutex);
+    const Snapshot*             snapshot = snapshots.findAtOrBefore(step);
+    if (snapshot == nullptr)
+        return false;
+    restoreSnapshot(*snapshot);
+    // the snapshot of the restored step is captured again, when the step is calculated anew
+    if (snapshot->step == 0)
+        snapshots.clear();
+    else
+        snapshots.discardAfter(snapshot->step - 1);
+    return true;
+}
+
+uint64_t
+Physics::resimulate(uint64_t fromStep, uint64_t toStep, float* divergence)
+{
+    std::lock_guard<std::mutex> guard(stepMutex);
+    const Snapshot*             snapshot = snapshots.findAtOrBefore(fromStep);
+    if (snapshot == nullptr || snapshot->step != fromStep)
+        return 0;
+    uint64_t liveStep = stepCount;
+    Snapshot live;
+    captureSnapshot(live, StepInputs());
+    restoreSnapshot(*snapshot);
+
+    uint64_t steps = 0;
+    while (stepCount < toStep && stepCount < liveStep)
+    {
+        // the inputs are the recorded ones, the tilt the game loop keeps setting meanwhile is not
+        // touched
+        const Snapshot* inputs = snapshots.findAtOrBefore(stepCount);
+        if (inputs == nullptr || inputs->step != stepCount)
+            break;  // the step was discarded by a rewind, its inputs are unknown
+        step(inputs->inputs, true);
+        steps++;
+    }
+
+    const Snapshot* captured = snapshots.findAtOrBefore(stepCount);
+    if (divergence != nullptr && captured != nullptr && captured->step == stepCount)
+        *divergence = glm::length(ballObjects[0].centerpoint - captured->balls[0].centerpoint);
+
+    // the game continues from the state before the resimulation
+    restoreSnapshot(live);
+    return steps;
+}
+
+void
+Physics::handleTriggers()
+{
+    const std::vector<TriggerVolume>& triggers = collisionIndex->getTriggers();
+    const glm::vec3&                  center   = ballObjects[0].centerpoint;
+    for (size_t i = 0; i < triggers.size(); i++)
     {
-        if (tmp.z < 0.0)
+        bool inside = triggers[i].contains(center);
+        if (inside != static_cast<bool>(insideTrigger[i]))
         {
-            return false;
+            insideTrigger[i] = inside;
+            TriggerEvent event;
+            event.entered     = inside;
+            event.type        = triggers[i].type;
+            event.id          = triggers[i].id;
+            event.ballIndex   = 0;
+            event.step        = stepCount;
+            event.centerpoint = center;
+            if (!triggerEvents.push(event))
+                std::cerr << "trigger event queue full, event dropped" << std::endl;
         }
     }
-    return true;
+}
+
+bool
+Physics::pollTriggerEvent(TriggerEvent& event)
+{
+    return triggerEvents.pop(event);
+}
+
+void
+Physics::quitPhysics()
+{
+    lock.lock();
+    quit = true;
+    lock.unlock();
 }
 
 void
@@ -0,0 +1,87 @@
+#include "PhysicsWatchdog.hpp"
+#include <algorithm>
+#include <iostream>
+
+PhysicsWatchdog::PhysicsWatchdog(
+    float budget, size_t window, float degradeRatio, float recoverRatio, size_t recoverWindows)
+: budget(budget)
+, window(window)
+, degradeRatio(degradeRatio)
+, recoverRatio(recoverRatio)
+, recoverWindows(recoverWindows)
+, level(Nominal)
+, windowSteps(0)
+, windowOverruns(0)
+, windowMaxTime(0.0f)
+, calmWindows(0)
+, totalSteps(0)
+, totalOverruns(0)
+{
+}
+
+void
+PhysicsWatchdog::record(float stepTime)
+{
+    totalSteps++;
+    windowSteps++;
+    windowMaxTime = std::max(windowMaxTime, stepTime);
+    if (stepTime > budget)
+    {
+        totalOverruns++;
+        windowOverruns++;
+    }
+    if (windowSteps >= window)
+        evaluateWindow();
+}
+
+void
+PhysicsWatchdog::evaluateWindow()
+{
+    float ratio = static_cast<float>(windowOverruns) / windowSteps;
+
+    if (ratio > degradeRatio)
+    {
+        calmWindows = 0;
+        if (level + 1 < LevelCount)
+        {
+            level = static_cast<Level>(level + 1);
+            std::cout << "physics watchdog: " << windowOverruns << "/" << windowSteps
+                      << " steps over budget of " << budget * 1000.0f << " ms (max "
+                      << windowMaxTime * 1000.0f << " ms), degraded to " << levelName(level)
+                      << std::endl;
+        }
+    }
+    else if (ratio <= recoverRatio)
+    {
+        if (level != Nominal && ++calmWindows >= recoverWindows)
+        {
+            calmWindows = 0;
+            level       = static_cast<Level>(level - 1);
+            std::cout << "physics watchdog: recovered to " << levelName(level) << std::endl;
+        }
+    }
+    else
+    {
+        calmWindows = 0;
+    }
+
+    windowSteps    = 0;
+    windowOverruns = 0;
+    windowMaxTime  = 0.0f;
+}
+
+const char*
+PhysicsWatchdog::levelName(Level level)
+{
+    switch (level)
+    {
+        case Nominal:
+            return "nominal";
+        case NoVisualRotation:
+            return "no visual rotation";
+        case CoarseCollisions:
+            return "coarse collisions";
+        default:
+            return "unknown";
+    }
+}
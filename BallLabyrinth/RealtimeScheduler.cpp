@@ -0,0 +1,65 @@
+#include "RealtimeScheduler.hpp"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+bool
+RealtimeScheduler::apply(const Config& config, const std::string& name)
+{
+    if (!config.enabled)
+        return true;
+
+    bool complete = true;
+#ifdef __linux__
+    if (config.lockMemory)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        {
+            std::cerr << name << ": memory locking failed (" << std::strerror(errno)
+                      << "), page faults may delay the thread" << std::endl;
+            complete = false;
+        }
+    }
+
+    if (config.cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config.cpu, &cpus);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0)
+        {
+            std::cerr << name << ": pinning to cpu " << config.cpu << " failed ("
+                      << std::strerror(error) << "), thread may migrate" << std::endl;
+            complete = false;
+        }
+    }
+
+    if (config.priority > 0)
+    {
+        sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        int error            = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0)
+        {
+            std::cerr << name << ": SCHED_FIFO priority " << config.priority << " not permitted ("
+                      << std::strerror(error) << "), keeping the normal scheduler" << std::endl;
+            complete = false;
+        }
+    }
+#else
+    std::cerr << name << ": real-time scheduling is only supported on linux" << std::endl;
+    complete = false;
+#endif
+
+    if (complete)
+        std::cout << name << ": running with real-time scheduling" << std::endl;
+    return complete;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define GLM_FORCE_RADIANS
+
+#include <glm/glm.hpp>
+
+#define COLLISION_INDEX_CELL_SIZE 4.0 /**< Default edge length of a grid cell in centimeters. */
+
+/**
+ * Struct representing a static rigid body object as AABB box.
+ * AABB box according to:
+ * https://developer.mozilla.org/en-US/docs/Games/Techniques/3D_collision_detection
+ */
+struct StaticObject
+{
+    glm::vec3 edgepointMin; /**< Minimum point of box in physics coordination system. */
+    glm::vec3 edgepointMax; /**< Maximum point of box in physics coordination system. */
+
+    /**
+     * Constructor for static AABB box (wall).
+     * @param x1 x value of point1 on plane.
+     * @param y1 y value of point1 on plane.
+     * @param x2 x value of point2 on plane.
+     * @param y2 y value of point2 on plane.
+     * @param floorheight height level of labyrinth floor.
+     * @param wallheight height of labyrinth walls.
+     * @param wallwidth width of labyrinth walls, used to generate AABB box.
+     */
+    StaticObject(float x1,
+                 float y1,
+                 float x2,
+                 float y2,
+                 float floorheight,
+                 float wallheight,
+                 float wallwidth);
+};
+
+/**
+ * Struct representing a volume, which does not collide but reports when a ball enters or leaves it.
+ */
+struct TriggerVolume
+{
+    /**
+     * Kind of the trigger, decides how the game reacts on it.
+     */
+    enum Type
+    {
+        Goal,      /**< Ball left the labyrinth through the exit. */
+        Hole,      /**< Ball dropped into a hole. */
+        Checkpoint /**< Ball passed an intermediate checkpoint. */
+    };
+
+    Type      type;         /**< Kind of the trigger. */
+    int       id;           /**< User defined id, e.g. number of the checkpoint. */
+    glm::vec3 edgepointMin; /**< Minimum point of box in physics coordination system. */
+    glm::vec3 edgepointMax; /**< Maximum point of box in physics coordination system. */
+
+    TriggerVolume(Type type, int id, const glm::vec3& edgepointMin, const glm::vec3& edgepointMax)
+    : type(type), id(id), edgepointMin(edgepointMin), edgepointMax(edgepointMax)
+    {
+    }
+
+    /**
+     * Checks if a point lies inside the volume.
+     * @param point Point in physics coordination system.
+     */
+    bool contains(const glm::vec3& point) const
+    {
+        return point.x >= edgepointMin.x && point.x <= edgepointMax.x && point.y >= edgepointMin.y
+               && point.y <= edgepointMax.y && point.z >= edgepointMin.z
+               && point.z <= edgepointMax.z;
+    }
+};
+
+/**
+ * Static collision geometry of a labyrinth, binned into a uniform grid over the x/y plane.
+ * The grid is stored flat (cell offsets + item list), so a query only touches the cells around the
+ * ball instead of every wall. After build() the index is read only and can be queried from
+ * several threads at once.
+ */
+class CollisionIndex
+{
+private:
+    std::vector<StaticObject>  walls;    /**< All walls and static objects as AABB boxes. */
+    std::vector<TriggerVolume> triggers; /**< All trigger volumes. */
+
+    float     cellSize;   /**< Edge length of a grid cell. */
+    glm::vec2 gridOrigin; /**< Minimum x/y corner of the grid. */
+    int       cellsX;     /**< Number of cells in x direction. */
+    int       cellsY;     /**< Number of cells in y direction. */
+
+    std::vector<uint32_t> cellStart; /**< Offset into cellItems for every cell, plus end marker. */
+    std::vector<uint32_t> cellItems; /**< Wall indices of all cells, cell after cell. */
+
+    /**
+     * Computes the clamped cell range overlapped by the x/y extent of a box.
+     * @return false if the box lies completely outside of the grid.
+     */
+    bool cellRange(const glm::vec3& min, const glm::vec3& max, int& x0, int& y0, int& x1, int& y1)
+        const;
+
+public:
+    /**
+     * Constructor for an empty collision index.
+     * @param cellSize Edge length of a grid cell in centimeters.
+     */
+    explicit CollisionIndex(float cellSize = COLLISION_INDEX_CELL_SIZE);
+
+    /**
+     * Adds a wall, only taken into account by queries after the next build().
+     */
+    void addWall(const StaticObject& wall);
+
+    /**
+     * Adds a trigger volume.
+     */
+    void addTrigger(const TriggerVolume& trigger);
+
+    /**
+     * Bins all walls into the grid, has to be called after all walls were added.
+     */
+    void build();
+
+    /**
+     * Collects the indices of all walls whose grid cells overlap the given box. Every wall is
+     * reported only once.
+     * @param min Minimum point of the query box.
+     * @param max Maximum point of the query box.
+     * @param out Array receiving the wall indices.
+     * @param maxOut Size of out, further walls are ignored.
+     * @return Number of indices written to out.
+     */
+    size_t query(const glm::vec3& min, const glm::vec3& max, uint32_t* out, size_t maxOut) const;
+
+    const StaticObject& getWall(uint32_t index) const { return walls[index]; }
+
+    const std::vector<StaticObject>& getWalls() const { return walls; }
+
+    const std::vector<TriggerVolume>& getTriggers() const { return triggers; }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define GLM_FORCE_RADIANS
+
+#include <glm/glm.hpp>
+
+#include "CollisionIndex.hpp"
+
+/**
+ * Distance to the goal for every cell of a labyrinth, computed once per level by a breadth first
+ * search over the cell grid, starting at the openings in the outer wall. Every cell stores the
+ * point the ball has to roll to next, so the way out is a constant time lookup at the cell of the
+ * ball. After build() the field is read only and can be used from several threads at once.
+ */
+class FlowField
+{
+public:
+    static const uint16_t unreachable = 0xFFFF; /**< Distance of cells without a way out. */
+
+private:
+    glm::vec2 origin;    /**< Minimum x/y corner of the labyrinth. */
+    float     pitch;     /**< Distance of two neighbouring grid lines, a cell plus a wall. */
+    float     wallwidth; /**< Width of the walls, which lie at the lower end of every cell. */
+    int       columns;   /**< Number of cells in x direction. */
+    int       rows;      /**< Number of cells in y direction. */
+
+    std::vector<uint16_t>  distance; /**< Number of cells to the nearest opening, per cell. */
+    std::vector<glm::vec2> target;   /**< Point to roll to next, per cell. */
+
+    /**
+     * Returns the center of a cell, also for cells just outside of the grid.
+     */
+    glm::vec2 center(int column, int row) const;
+
+    /**
+     * Checks if a wall lies between two points at the height of the walls.
+     */
+    bool
+    blocked(const CollisionIndex& index, const glm::vec2& a, const glm::vec2& b, float z) const;
+
+public:
+    FlowField();
+
+    /**
+     * Derives the cell grid from the walls and computes the distances. The walls have to lie on
+     * the grid written by Maze_generation/maze.py, every wall segment spanning one cell.
+     * @param index Built collision index holding the walls and the floor.
+     * @param origin Minimum x/y corner of the labyrinth.
+     * @param size Width of the labyrinth in x and y direction.
+     * @param wallwidth Width of the walls.
+     * @param floorheight Height level of the labyrinth floor.
+     * @param wallheight Height of the labyrinth walls.
+     * @return Number of cells with a way out.
+     */
+    size_t build(const CollisionIndex& index,
+                 const glm::vec2&      origin,
+                 const glm::vec2&      size,
+                 float                 wallwidth,
+                 float                 floorheight,
+                 float                 wallheight);
+
+    /**
+     * Looks up the direction to roll to at a point, in constant time.
+     * @param point Point in physics coordination system, e.g. the centerpoint of the ball.
+     * @param direction Receives the normalized x/y direction towards the next cell.
+     * @return false if the point lies outside of the grid or its cell has no way out.
+     */
+    bool getDirection(const glm::vec3& point, glm::vec2& direction) const;
+
+    /**
+     * Returns the number of cells to the nearest opening, unreachable if there is none.
+     */
+    uint16_t getDistance(int column, int row) const { return distance[row * columns + column]; }
+
+    int getColumns() const { return columns; }
+
+    int getRows() const { return rows; }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+
+#define HANDLE_FILTER_THETA 0.8 /**< Smoothing of the handle filter, 0 follows every sample. */
+#define HANDLE_FILTER_RESET 0.1 /**< Sample gap in seconds after which the filter restarts. */
+
+/**
+ * Filtered state of a handle at one point in time.
+ */
+struct HandleEstimate
+{
+    double pos = 0.0; /**< Filtered position. */
+    double vel = 0.0; /**< Velocity in position units per second. */
+    double acc = 0.0; /**< Acceleration in position units per second squared. */
+    std::chrono::steady_clock::time_point time; /**< Time the last sample was received. */
+};
+
+/**
+ * Alpha-beta-gamma filter estimating position, velocity and acceleration of a handle from its
+ * position samples. The gains are the critically damped ones of a fading memory filter, so a
+ * single smoothing parameter theta tunes them.
+ */
+class HandleEstimator
+{
+private:
+    double         alpha;       /**< Gain of the position residual. */
+    double         beta;        /**< Gain of the velocity residual. */
+    double         gamma;       /**< Gain of the acceleration residual. */
+    bool           initialized; /**< Set after the first sample. */
+    HandleEstimate estimate;
+
+public:
+    /**
+     * Constructor for the filter.
+     * @param theta Smoothing between 0 and 1, larger values smooth more and lag more.
+     */
+    explicit HandleEstimator(double theta = HANDLE_FILTER_THETA)
+    : alpha(1.0 - theta * theta * theta)
+    , beta(1.5 * (1.0 - theta) * (1.0 - theta) * (1.0 + theta))
+    , gamma(0.5 * (1.0 - theta) * (1.0 - theta) * (1.0 - theta))
+    , initialized(false)
+    {
+    }
+
+    /**
+     * Updates the estimate with a new sample.
+     * @param measurement Measured position.
+     * @param dt Time since the previous sample in seconds, taken from the device timestamps.
+     * @param time Time the sample was received.
+     */
+    const HandleEstimate&
+    update(double measurement, double dt, std::chrono::steady_clock::time_point time)
+    {
+        if (!initialized || dt <= 0.0 || dt > HANDLE_FILTER_RESET)
+        {  // nothing to predict from, start over at the sample
+            estimate.pos = measurement;
+            estimate.vel = 0.0;
+            estimate.acc = 0.0;
+            initialized  = true;
+        }
+        else
+        {
+            double pos      = estimate.pos + estimate.vel * dt + 0.5 * estimate.acc * dt * dt;
+            double vel      = estimate.vel + estimate.acc * dt;
+            double residual = measurement - pos;
+            estimate.pos    = pos + alpha * residual;
+            estimate.vel    = vel + beta * residual / dt;
+            estimate.acc += 2.0 * gamma * residual / (dt * dt);
+        }
+        estimate.time = time;
+        return estimate;
+    }
+
+    const HandleEstimate& get() const { return estimate; }
+
+    void reset() { initialized = false; }
+};
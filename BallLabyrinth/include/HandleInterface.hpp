@@ -1,40 +1,154 @@
 #pragma once
 #include <thread>
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "HandleEstimator.hpp"
+#include "HandleRecorder.hpp"
+#include "HapticTelemetry.hpp"
+#include "PeriodicTimer.hpp"
+#include "RealtimeScheduler.hpp"
+#include "SeqLock.hpp"
+#include "SerialStats.hpp"
+
+#define HANDLE_SERVO_RATE 1000.0 /**< Default rate of the haptic servo loop in Hz. */
+#define HANDLE_AXES 2            /**< Number of board axes the handles are mapped onto. */
+#define HANDLE_MAX_DEVICES 8     /**< Maximum number of devices served by the IO thread. */
+
+static_assert(TELEMETRY_AXES == HANDLE_AXES, "telemetry samples need one entry per board axis");
 
 class HapticForceManager;
 
 class HandleInterface {
+public:
+    /**
+     * Struct describing one handle device and the board axis it is mapped onto. Several devices
+     * on the same axis are averaged, e.g. two players or redundant sensors.
+     */
+    struct Device
+    {
+        std::string device;   /**< Serial device or recording, see HandleTransport::open. */
+        size_t      axis;     /**< Board axis controlled by the device, 0 or 1. */
+        double      gain;     /**< Scale of the device position onto the axis, the axis force is
+                                   scaled back the same way. -1 mirrors the device. */
+
+        Device(const std::string& device, size_t axis, double gain = 1.0)
+        : device(device), axis(axis), gain(gain)
+        {
+        }
+    };
+
+    /**
+     * Struct representing the state of both board axes at one point in time.
+     */
+    struct HandleState
+    {
+        double pos[HANDLE_AXES]   = {}; /**< Position per axis, averaged over its devices. */
+        double force[HANDLE_AXES] = {}; /**< Force last sent per axis. */
+        PeriodicTimer::Clock::time_point posTime[HANDLE_AXES]; /**< Time pos was received. */
+        PeriodicTimer::Clock::time_point forceTime; /**< Time the forces were sent. */
+        HandleEstimate estimate[HANDLE_AXES]; /**< Filtered state per axis, updated with every
+                                                   sample of its devices. */
+    };
+
 private:
     size_t baud;
-    std::string dev1;
-    std::string dev2;
-    double force1;
-    double force2;
-    double pos1;
-    double pos2;
+    double servoRate;                        /**< Rate of the servo loop in Hz. */
+    RealtimeScheduler::Config servoRealtime; /**< Real-time setup of the servo thread. */
+    PeriodicTimer servoTimer;                /**< Absolute deadlines of the servo loop. */
+    std::atomic<uint64_t> servoTicks;        /**< Number of servo loop iterations. */
+    std::vector<Device>   devices;           /**< All devices, one transport each. */
+    SeqLock<HandleState> state; /**< Published handle state, read without blocking the writers. */
+    std::vector<std::unique_ptr<SerialStats>> portStats; /**< Counters per serial port. */
+    // per device, used by the IO thread only
+    HandleEstimator estimators[HANDLE_MAX_DEVICES];      /**< Filters of the devices. */
+    HandleEstimate  deviceEstimates[HANDLE_MAX_DEVICES]; /**< Last filtered state. */
+    double          devicePos[HANDLE_MAX_DEVICES];       /**< Last position sample. */
+    uint32_t        sampleTimestamp[HANDLE_MAX_DEVICES]; /**< Device time of the last sample. */
+    HandleRecorder recorder; /**< Records samples and forces, fed by the IO thread. */
+    HapticTelemetry telemetry; /**< Traces every servo tick, fed by the IO thread. */
     std::thread thread;
-    mutable std::recursive_mutex mutex;
-    HapticForceManager* hapticForceManager;
+    std::atomic<HapticForceManager*> hapticForceManager;
+
+    /**
+     * IO thread, opens the serial ports and runs one event loop serving all of them and the servo
+     * timer, which computes and sends the handle forces at the servo rate until quit is set or a
+     * port fails.
+     */
     void run();
 
-    void setPos1(double pos);
-    void setPos2(double pos);
+    /**
+     * Publishes a new position sample of a device and the state of its axis.
+     * @param deviceTimestamp Timestamp of the sample in microseconds of the device clock, which
+     * gives the time between samples without the jitter of the serial link.
+     */
+    void setPos(size_t device, double pos, uint32_t deviceTimestamp);
+    void setForces(const double force[HANDLE_AXES]);
 
 public:
-    HandleInterface(size_t baud, const std::string& dev1, const std::string& dev2);
+    /**
+     * Constructor, starts the servo thread.
+     * @param baud Baud rate of all serial ports.
+     * @param devices Devices and their mapping onto the board axes, at most HANDLE_MAX_DEVICES.
+     * A device is a serial port, or a recording to replay, see HandleTransport::open.
+     * @param servoRate Rate of the servo loop in Hz.
+     * @param servoRealtime Real-time setup of the servo thread.
+     * @param recordPath File all samples and forces are recorded to, none if empty.
+     * @param telemetryPath File the inputs, forces and timing of every servo tick are traced to,
+     * none if empty, see HapticTelemetry.
+     * @throws std::invalid_argument if there are too many devices or an axis does not exist.
+     */
+    HandleInterface(size_t                           baud,
+                    const std::vector<Device>&       devices,
+                    double                           servoRate     = HANDLE_SERVO_RATE,
+                    const RealtimeScheduler::Config& servoRealtime = RealtimeScheduler::Config(),
+                    const std::string&               recordPath    = std::string(),
+                    const std::string&               telemetryPath = std::string());
     ~HandleInterface();
 
-    double getPos1();
-    double getPos2();
+    /**
+     * Sets quit and waits until the servo thread has closed the ports and ended, so it does not
+     * touch the HapticForceManager anymore. Called by the destructor as well.
+     */
+    void stop();
+
+    /**
+     * Returns how late the servo thread woke up for its ticks.
+     */
+    const LatencyHistogram& getServoJitter() const { return servoTimer.getJitter(); }
+
+    /**
+     * Returns the number of servo ticks, which missed their deadline by a whole period.
+     */
+    uint64_t getServoMissedDeadlines() const { return servoTimer.getMissedDeadlines(); }
+
+    uint64_t getServoTicks() const { return servoTicks.load(std::memory_order_relaxed); }
+
+    size_t getPortCount() const { return portStats.size(); }
+
+    /**
+     * Returns the throughput and latency counters of a serial port, updated while running.
+     * @param port Index of the device.
+     */
+    const SerialStats& getPortStats(size_t port) const { return *portStats[port]; }
+
+    const Device& getDevice(size_t port) const { return devices[port]; }
+
+    /**
+     * Returns a consistent snapshot of both axes, in which all positions come from the same
+     * read. Never blocks the serial callbacks.
+     */
+    HandleState getState() const;
+
+    double getPos(size_t axis) const;
 
-    double getForce1();
-    double getForce2();
+    double getForce(size_t axis) const;
 
-    void setForce1(double force);
-    void setForce2(double force);
+    void setForce(size_t axis, double force);
 
     void setHapticForceManager(HapticForceManager* manager);
 
-    bool quit;
+    std::atomic<bool> quit;
 };
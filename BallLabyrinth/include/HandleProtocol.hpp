@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * Framed binary protocol spoken between the host and the handle firmware (handle.ino), in both
+ * directions. All multi byte fields are little endian.
+ *
+ *     offset  size  field
+ *          0     1  sync byte 0xA5
+ *          1     1  sync byte 0x5A
+ *          2     1  frame type
+ *          3     1  payload length n
+ *          4     2  sequence number, incremented per frame by the sender
+ *          6     4  timestamp of the sender in microseconds
+ *         10     n  payload
+ *       10+n     2  CRC-16/CCITT-FALSE over the bytes 2 .. 10+n-1
+ *
+ * A receiver scans for the sync bytes and drops single bytes until a frame with a valid checksum
+ * is found, so it resynchronizes after corrupted or partial frames.
+ */
+class HandleProtocol
+{
+public:
+    /**
+     * Frame types.
+     */
+    enum FrameType : uint8_t
+    {
+        Position = 'P', /**< Device to host, payload: int32 handle position * 1e6, uint16 sequence
+                           number of the last frame received by the device, uint16 microseconds
+                           since it was received or noAck. */
+        Force    = 'F', /**< Host to device, payload: int32 force * 1e6. */
+        Model    = 'M'  /**< Host to device, payload: LocalModel, see writeLocalModel. */
+    };
+
+    /**
+     * Flags of the effects a LocalModel enables.
+     */
+    enum LocalModelFlags : uint8_t
+    {
+        LocalWalls        = 1, /**< Walls at wallMin and wallMax. */
+        LocalCenterSpring = 2  /**< Spring towards 0 outside of the dead band. */
+    };
+
+    /**
+     * Force model the handle renders in its own control loop, added to the streamed forces.
+     * Uses the units and formulas of HapticForceManager.
+     */
+    struct LocalModel
+    {
+        double  wallMin          = 0.0; /**< Position of the lower wall. */
+        double  wallMax          = 0.0; /**< Position of the upper wall. */
+        double  wallK            = 0.0; /**< Stiffness of the walls. */
+        double  centerSpringK    = 0.0; /**< Stiffness of the center spring. */
+        double  centerSpringDead = 0.0; /**< Dead band of the center spring around 0. */
+        uint8_t flags            = 0;   /**< Enabled effects, LocalModelFlags. */
+
+        bool operator==(const LocalModel& other) const
+        {
+            return wallMin == other.wallMin && wallMax == other.wallMax && wallK == other.wallK
+                   && centerSpringK == other.centerSpringK
+                   && centerSpringDead == other.centerSpringDead && flags == other.flags;
+        }
+
+        bool operator!=(const LocalModel& other) const { return !(*this == other); }
+    };
+
+    static const uint8_t  sync0        = 0xA5;
+    static const uint8_t  sync1        = 0x5A;
+    static const size_t   headerSize   = 10;
+    static const size_t   crcSize      = 2;
+    static const size_t   maxPayload   = 32;
+    static const size_t   maxFrameSize = headerSize + maxPayload + crcSize;
+    static const size_t   positionSize = 8;      /**< Payload size of position frames. */
+    static const size_t   modelSize    = 21;     /**< Payload size of model frames. */
+    static const uint16_t noAck        = 0xFFFF; /**< Ack delay if nothing was received yet. */
+    static const double   valueScale; /**< Scale of fixed point values in payloads. */
+
+    /**
+     * View on a complete and verified frame, which stays in the buffer it was received in.
+     * Only valid as long as that buffer is not modified.
+     */
+    class FrameView
+    {
+    private:
+        const uint8_t* data;
+
+    public:
+        explicit FrameView(const uint8_t* data) : data(data) {}
+
+        uint8_t type() const { return data[2]; }
+
+        size_t payloadSize() const { return data[3]; }
+
+        uint16_t seq() const { return readUint16(data + 4); }
+
+        uint32_t timestamp() const { return readUint32(data + 6); }
+
+        const uint8_t* payload() const { return data + headerSize; }
+
+        size_t size() const { return headerSize + payloadSize() + crcSize; }
+
+        const uint8_t* bytes() const { return data; } /**< The whole frame, size() bytes. */
+
+        /**
+         * Reads a fixed point value from the payload.
+         * @param offset Byte offset of the value within the payload.
+         */
+        double value(size_t offset = 0) const
+        {
+            return offset + 4 <= payloadSize()
+                       ? static_cast<int32_t>(readUint32(payload() + offset)) / valueScale
+                       : 0.0;
+        }
+
+        /**
+         * Reads the payload of a model frame.
+         */
+        LocalModel localModel() const
+        {
+            LocalModel model;
+            if (payloadSize() < modelSize)
+                return model;
+            model.wallMin          = value(0);
+            model.wallMax          = value(4);
+            model.wallK            = value(8);
+            model.centerSpringK    = value(12);
+            model.centerSpringDead = value(16);
+            model.flags            = payload()[20];
+            return model;
+        }
+
+        /**
+         * Returns the sequence number of the last frame the device received, for position frames.
+         */
+        uint16_t ackSeq() const
+        {
+            return payloadSize() >= positionSize ? readUint16(payload() + 4) : 0;
+        }
+
+        /**
+         * Returns the microseconds the device held the acknowledged frame before sending this
+         * one, or noAck.
+         */
+        uint16_t ackDelay() const
+        {
+            return payloadSize() >= positionSize ? readUint16(payload() + 6) : noAck;
+        }
+    };
+
+    /**
+     * Counters of a receiver, to tell a clean link from a noisy one.
+     */
+    struct ParseStats
+    {
+        uint64_t frames       = 0; /**< Frames with a valid checksum. */
+        uint64_t crcErrors    = 0; /**< Frames dropped because of a wrong checksum. */
+        uint64_t skippedBytes = 0; /**< Bytes dropped while searching for the sync bytes. */
+    };
+
+    static uint16_t readUint16(const uint8_t* data)
+    {
+        return static_cast<uint16_t>(data[0] | (data[1] << 8));
+    }
+
+    static uint32_t readUint32(const uint8_t* data)
+    {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8)
+               | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    static void writeUint16(uint8_t* data, uint16_t value)
+    {
+        data[0] = value & 0xFF;
+        data[1] = value >> 8;
+    }
+
+    static void writeUint32(uint8_t* data, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            data[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    /**
+     * Calculates the CRC-16/CCITT-FALSE checksum (polynomial 0x1021, initial value 0xFFFF).
+     */
+    static uint16_t crc16(const uint8_t* data, size_t size);
+
+    /**
+     * Encodes a frame.
+     * @param out Buffer with at least headerSize + size + crcSize bytes.
+     * @param payload Payload bytes, at most maxPayload.
+     * @return Size of the frame in bytes, 0 if the payload is too large.
+     */
+    static size_t encode(uint8_t*       out,
+                         FrameType      type,
+                         uint16_t       seq,
+                         uint32_t       timestamp,
+                         const uint8_t* payload,
+                         size_t         size);
+
+    /**
+     * Encodes a frame with a single fixed point value as payload.
+     * @param out Buffer with at least headerSize + 4 + crcSize bytes.
+     * @return Size of the frame in bytes.
+     */
+    static size_t
+    encodeValue(uint8_t* out, FrameType type, uint16_t seq, uint32_t timestamp, double value);
+
+    /**
+     * Encodes a position frame.
+     * @param out Buffer with at least headerSize + positionSize + crcSize bytes.
+     * @param ackSeq Sequence number of the last frame received from the host.
+     * @param ackDelay Microseconds since that frame was received, noAck if none was received.
+     * @return Size of the frame in bytes.
+     */
+    static size_t encodePosition(uint8_t* out,
+                                 uint16_t seq,
+                                 uint32_t timestamp,
+                                 double   position,
+                                 uint16_t ackSeq,
+                                 uint16_t ackDelay);
+
+    /**
+     * Writes the payload of a model frame, five int32 values * 1e6 in the order of LocalModel
+     * followed by the flags.
+     * @param payload Buffer with at least modelSize bytes.
+     * @return Size of the payload in bytes.
+     */
+    static size_t writeLocalModel(uint8_t* payload, const LocalModel& model);
+
+    /**
+     * Parses all complete frames in a buffer in place, independent of how the byte stream was
+     * chunked. Incomplete frames at the end of the buffer are left for the next call.
+     * @param data Received bytes.
+     * @param size Number of received bytes.
+     * @param onFrame Callable taking a const FrameView&, called for every valid frame.
+     * @param stats Counters updated while parsing, may be nullptr.
+     * @return Number of bytes consumed, the remaining bytes have to be passed again together with
+     * the following bytes.
+     */
+    template<typename F>
+    static size_t parse(const uint8_t* data, size_t size, F&& onFrame, ParseStats* stats = nullptr)
+    {
+        size_t pos = 0;
+        while (pos < size)
+        {
+            if (data[pos] != sync0 || (pos + 1 < size && data[pos + 1] != sync1))
+            {
+                pos++;
+                if (stats != nullptr)
+                    stats->skippedBytes++;
+                continue;
+            }
+            if (size - pos < headerSize)
+                break;
+            size_t payloadSize = data[pos + 3];
+            if (payloadSize > maxPayload)
+            {
+                pos++;
+                if (stats != nullptr)
+                    stats->skippedBytes++;
+                continue;
+            }
+            size_t frameSize = headerSize + payloadSize + crcSize;
+            if (size - pos < frameSize)
+                break;
+            uint16_t crc = crc16(data + pos + 2, headerSize - 2 + payloadSize);
+            if (crc != readUint16(data + pos + headerSize + payloadSize))
+            {
+                pos++;
+                if (stats != nullptr)
+                    stats->crcErrors++;
+                continue;
+            }
+            if (stats != nullptr)
+                stats->frames++;
+            onFrame(FrameView(data + pos));
+            pos += frameSize;
+        }
+        return pos;
+    }
+
+    /**
+     * Streaming decoder for receivers, which get their bytes in arbitrary chunks and do not keep
+     * them. Buffers incomplete frames internally.
+     */
+    class Decoder
+    {
+    private:
+        uint8_t    buffer[2 * maxFrameSize]; /**< Incomplete frame plus newly fed bytes. */
+        size_t     fill;                     /**< Number of valid bytes in buffer. */
+        ParseStats stats;
+
+    public:
+        Decoder() : fill(0) {}
+
+        /**
+         * Feeds received bytes and calls onFrame for every frame completed by them.
+         * @param onFrame Callable taking a const FrameView&, the view is only valid during the
+         * call.
+         */
+        template<typename F>
+        void feed(const uint8_t* data, size_t size, F&& onFrame)
+        {
+            while (size > 0)
+            {
+                size_t chunk = sizeof(buffer) - fill < size ? sizeof(buffer) - fill : size;
+                std::memcpy(buffer + fill, data, chunk);
+                fill += chunk;
+                data += chunk;
+                size -= chunk;
+
+                size_t consumed = parse(buffer, fill, onFrame, &stats);
+                std::memmove(buffer, buffer + consumed, fill - consumed);
+                fill -= consumed;
+            }
+        }
+
+        const ParseStats& getStats() const { return stats; }
+    };
+};
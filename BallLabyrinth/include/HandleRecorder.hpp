@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HandleProtocol.hpp"
+#include "SpscQueue.hpp"
+
+#define RECORDER_QUEUE_SIZE 8192 /**< Records buffered between two flushes, power of 2. */
+#define RECORDER_FLUSH_INTERVAL std::chrono::milliseconds(20) /**< Period of the writer thread. */
+
+/**
+ * One recorded handle sample or force command.
+ */
+struct HandleRecord
+{
+    HandleProtocol::FrameType type; /**< Position for samples, Force for force commands. */
+    uint8_t                   device; /**< Index of the device in HandleInterface. */
+    int64_t  timeUs; /**< Host time in microseconds, relative to the start when loaded. */
+    uint32_t deviceTimestamp; /**< Timestamp of the device for samples, 0 for force commands. */
+    double   value;           /**< Position or force. */
+};
+
+/**
+ * Records the handle samples and force commands of a session into an append-only binary file.
+ * The IO thread queues the records without blocking, a background thread writes them.
+ *
+ *     header  4  magic "HREC"
+ *             2  version
+ *             1  number of devices
+ *             1  reserved
+ *     record  1  type, 'P' or 'F'
+ *             1  device
+ *             4  microseconds since the previous record or the start of the recording
+ *             4  timestamp of the device
+ *             4  int32 value * 1e6
+ *
+ * All multi byte fields are little endian, as in HandleProtocol.
+ */
+class HandleRecorder
+{
+public:
+    static const uint16_t version    = 1;
+    static const size_t   headerSize = 8;
+    static const size_t   recordSize = 14;
+
+private:
+    SpscQueue<HandleRecord, RECORDER_QUEUE_SIZE> queue; /**< Filled by the IO thread. */
+    std::atomic<bool>     running; /**< Records are accepted and written. */
+    std::atomic<uint64_t> written; /**< Records written to the file. */
+    std::atomic<uint64_t> dropped; /**< Records dropped because the queue was full. */
+    std::ofstream         file;
+    std::thread           writer;
+    int64_t               lastTimeUs; /**< Time of the last written record, writer thread only. */
+
+    /**
+     * Writer thread, flushes the queue to the file periodically until the recorder is closed.
+     */
+    void run();
+
+    /**
+     * Encodes all queued records and writes them at once.
+     */
+    void flush(std::vector<uint8_t>& buffer);
+
+public:
+    HandleRecorder();
+    ~HandleRecorder();
+
+    HandleRecorder(const HandleRecorder&) = delete;
+    HandleRecorder& operator=(const HandleRecorder&) = delete;
+
+    /**
+     * Creates the file and starts the writer thread.
+     * @param deviceCount Number of devices stored in the header.
+     * @return false if the file could not be created.
+     */
+    bool open(const std::string& path, size_t deviceCount);
+
+    /**
+     * Writes the remaining records and closes the file.
+     */
+    void close();
+
+    bool isOpen() const { return running.load(std::memory_order_relaxed); }
+
+    /**
+     * Queues a record with the current time, called by one producer thread only. Never blocks,
+     * does nothing if the recorder is not open.
+     */
+    void record(HandleProtocol::FrameType type,
+                size_t                    device,
+                uint32_t                  deviceTimestamp,
+                double                    value);
+
+    uint64_t getWritten() const { return written.load(std::memory_order_relaxed); }
+
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * Reads a recording.
+     * @param records Receives all records, with times relative to the start of the recording.
+     * @param deviceCount Receives the number of recorded devices, may be nullptr.
+     * @return false if the file cannot be read or is no recording.
+     */
+    static bool load(const std::string&         path,
+                     std::vector<HandleRecord>& records,
+                     size_t*                    deviceCount = nullptr);
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "HandleProtocol.hpp"
+#include "SerialStats.hpp"
+
+#define HANDLE_TRANSPORT_ALIGNMENT 64 /**< Alignment of transports, that of their queues. */
+
+/**
+ * Connection to one handle device, served by the event loop of the IO thread of
+ * HandleInterface. Received frames are passed to a callback, forces and other frames are sent
+ * with write and send.
+ */
+class HandleTransport
+{
+public:
+    typedef std::function<void(const HandleProtocol::FrameView&)> FrameCallback;
+
+    /**
+     * Opens the transport matching the device name:
+     * replay:FILE replays a recording (see HandleRecorder) at its original timing, udp:HOST:PORT
+     * connects to a network bridge (see UdpTransport), anything else is opened as serial port.
+     * @param index Index of the device, selects the recorded device when replaying.
+     * @throws std::exception if the device cannot be opened.
+     */
+    static std::unique_ptr<HandleTransport> open(boost::asio::io_service& ioService,
+                                                 unsigned int             baud,
+                                                 const std::string&       device,
+                                                 size_t                   index,
+                                                 FrameCallback            readCallback,
+                                                 SerialStats&             stats);
+
+    /**
+     * Transports contain cache line aligned queues, which the global operator new does not
+     * respect before C++17.
+     */
+    static void* operator new(size_t size);
+    static void  operator delete(void* pointer);
+
+    HandleTransport() : active(true) {}
+
+    HandleTransport(const HandleTransport&) = delete;
+    HandleTransport& operator=(const HandleTransport&) = delete;
+
+    virtual ~HandleTransport() {}
+
+    /**
+     * Sets the force to send, a force which was not sent yet is replaced by the newer one.
+     */
+    virtual void write(double force) = 0;
+
+    /**
+     * Queues a frame, which is sent in order with the others, only one thread may call this.
+     * @return false if the frame was dropped.
+     */
+    virtual bool send(HandleProtocol::FrameType type, const uint8_t* payload, size_t size) = 0;
+
+    /**
+     * Closes the transport from within the event loop, so its pending operations end.
+     */
+    virtual void close() = 0;
+
+    /**
+     * Returns true while the transport is still operating.
+     */
+    bool isActive() const { return active; }
+
+protected:
+    bool active; /**< Cleared by the event loop, once the transport failed or was closed. */
+};
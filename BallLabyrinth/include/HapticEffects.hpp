@@ -0,0 +1,297 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#define HAPTIC_EFFECT_CAPACITY 128 /**< Effects the table holds, allocated once. */
+
+/**
+ * Parameter block of one haptic effect on one handle. All effect types share this layout, so a
+ * table of effects is one contiguous array, which is evaluated without virtual calls.
+ * Forces follow the sign convention of HapticForceManager, a spring pulls with k * (pos - rest).
+ */
+struct HapticEffect
+{
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Effect types, the meaning of the parameters depends on them.
+     */
+    enum Type : uint8_t
+    {
+        Spring,    /**< gain * distance outside of position +- width, e.g. center spring, walls. */
+        Damper,    /**< gain * velocity of the handle. */
+        Detent,    /**< Notches every width starting at position, with stiffness gain. */
+        Vibration, /**< gain * exp(-decay t) * sin(2 pi rate t), t since start. */
+        Impulse    /**< Rises linearly to gain within width seconds, then gain * exp(-decay t'),
+                        t' since the end of the rise. */
+    };
+
+    /**
+     * Groups of effects, which can be switched on and off together.
+     */
+    enum Group : uint8_t
+    {
+        CenterSpring = 1, /**< Spring pulling the handle to the center. */
+        Walls        = 2, /**< Virtual walls limiting the range of the handle. */
+        Level        = 4, /**< Effects added by the current level. */
+        Collision    = 8  /**< Transients of the collisions of the ball. */
+    };
+
+    static const size_t groupCount = 4;
+
+    /**
+     * Returns the bit number of a single group, 0 for CenterSpring up to 3 for Collision.
+     */
+    static size_t groupIndex(uint8_t group)
+    {
+        size_t index = 0;
+        while (group > 1)
+        {
+            group >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+    Type              type;     /**< Kind of effect. */
+    uint8_t           group;    /**< Group the effect belongs to. */
+    uint8_t           handle;   /**< Handle the effect acts on, 0 or 1. */
+    float             position; /**< Rest position, center of dead band or offset of detents. */
+    float             gain;     /**< Stiffness, damping or amplitude. */
+    float             width;    /**< Half dead band of springs, spacing of detents, attack time of
+                                     impulses in seconds. */
+    float             rate;     /**< Frequency of vibrations in Hz. */
+    float             decay;    /**< Decay of impulses and vibrations in 1/s. */
+    float             duration; /**< Seconds after start until the effect ends, 0 for endless. */
+    Clock::time_point start;    /**< Time vibrations and impulses start at. */
+
+    HapticEffect(Type type, uint8_t group, uint8_t handle, float gain)
+    : type(type)
+    , group(group)
+    , handle(handle)
+    , position(0.0f)
+    , gain(gain)
+    , width(0.0f)
+    , rate(0.0f)
+    , decay(0.0f)
+    , duration(0.0f)
+    , start(Clock::now())
+    {
+    }
+
+    static HapticEffect
+    spring(uint8_t group, uint8_t handle, float k, float center = 0.0f, float deadBand = 0.0f)
+    {
+        HapticEffect effect(Spring, group, handle, k);
+        effect.position = center;
+        effect.width    = deadBand;
+        return effect;
+    }
+
+    static HapticEffect damper(uint8_t group, uint8_t handle, float b)
+    {
+        return HapticEffect(Damper, group, handle, b);
+    }
+
+    static HapticEffect
+    detent(uint8_t group, uint8_t handle, float k, float spacing, float offset = 0.0f)
+    {
+        HapticEffect effect(Detent, group, handle, k);
+        effect.position = offset;
+        effect.width    = spacing;
+        return effect;
+    }
+
+    /**
+     * Sine wave, damped to a ringing transient if decay is set.
+     */
+    static HapticEffect vibration(uint8_t group,
+                                  uint8_t handle,
+                                  float   amplitude,
+                                  float   frequency,
+                                  float   duration = 0.0f,
+                                  float   decay    = 0.0f)
+    {
+        HapticEffect effect(Vibration, group, handle, amplitude);
+        effect.rate     = frequency;
+        effect.decay    = decay;
+        effect.duration = duration;
+        return effect;
+    }
+
+    /**
+     * Attack and decay envelope, a pulse of the force peaking attack seconds after start.
+     */
+    static HapticEffect impulse(uint8_t group,
+                                uint8_t handle,
+                                float   force,
+                                float   decay,
+                                float   duration,
+                                float   attack = 0.0f)
+    {
+        HapticEffect effect(Impulse, group, handle, force);
+        effect.width    = attack;
+        effect.decay    = decay;
+        effect.duration = duration;
+        return effect;
+    }
+
+    /**
+     * Checks if a timed effect is over.
+     */
+    bool expired(Clock::time_point now) const
+    {
+        return duration > 0.0f && std::chrono::duration<float>(now - start).count() > duration;
+    }
+};
+
+/**
+ * Flat table of haptic effects, evaluated in one loop per servo tick. Effects are kept sorted by
+ * type, so the switch in the loop branches the same way for runs of effects. Adding effects only
+ * adds rows to the table, the cost per effect stays a few multiplications. The rows are allocated
+ * once, so effects are added by the servo loop without allocating.
+ * Not thread safe, HapticForceManager keeps it in the servo loop, other threads queue their
+ * changes, which the servo loop applies at the start of a tick.
+ */
+class HapticEffectTable
+{
+private:
+    std::vector<HapticEffect> effects;
+    size_t                    capacity; /**< Rows reserved in effects. */
+
+public:
+    explicit HapticEffectTable(size_t capacity = HAPTIC_EFFECT_CAPACITY) : capacity(capacity)
+    {
+        effects.reserve(capacity);
+    }
+
+    /**
+     * Adds an effect behind the last one of its type, never allocates.
+     * @return false if the table is full and the effect was dropped.
+     */
+    bool add(const HapticEffect& effect)
+    {
+        if (effects.size() >= capacity)
+            return false;
+        auto position = std::upper_bound(
+            effects.begin(),
+            effects.end(),
+            effect,
+            [](const HapticEffect& a, const HapticEffect& b) { return a.type < b.type; });
+        size_t index = position - effects.begin();
+        effects.push_back(effect);  // within the reserved rows, then rotated into place
+        std::rotate(effects.begin() + index, effects.end() - 1, effects.end());
+        return true;
+    }
+
+    /**
+     * Removes all effects of the given groups.
+     */
+    void remove(uint8_t groups)
+    {
+        effects.erase(std::remove_if(effects.begin(),
+                                     effects.end(),
+                                     [groups](const HapticEffect& e) { return e.group & groups; }),
+                      effects.end());
+    }
+
+    /**
+     * Removes timed effects which are over.
+     */
+    void removeExpired(HapticEffect::Clock::time_point now)
+    {
+        effects.erase(std::remove_if(effects.begin(),
+                                     effects.end(),
+                                     [now](const HapticEffect& e) { return e.expired(now); }),
+                      effects.end());
+    }
+
+    /**
+     * Removes the effect of the given groups which started first, if there is one.
+     */
+    void removeOldest(uint8_t groups)
+    {
+        auto oldest = effects.end();
+        for (auto e = effects.begin(); e != effects.end(); ++e)
+            if ((e->group & groups) && (oldest == effects.end() || e->start < oldest->start))
+                oldest = e;
+        if (oldest != effects.end())
+            effects.erase(oldest);
+    }
+
+    /**
+     * Counts the effects of the given groups.
+     */
+    size_t count(uint8_t groups) const
+    {
+        return std::count_if(effects.begin(), effects.end(), [groups](const HapticEffect& e) {
+            return (e.group & groups) != 0;
+        });
+    }
+
+    size_t size() const { return effects.size(); }
+
+    /**
+     * Sums the forces of all effects of the enabled groups.
+     * @param pos Positions of both handles.
+     * @param vel Velocities of both handles.
+     * @param groups Enabled groups.
+     * @param groupForces If set, receives the force of each group by HapticEffect::groupIndex,
+     * HapticEffect::groupCount entries.
+     * @return Force on handle 1 and handle 2.
+     */
+    glm::vec2 evaluate(const double                    pos[2],
+                       const double                    vel[2],
+                       uint8_t                         groups,
+                       HapticEffect::Clock::time_point now,
+                       glm::vec2*                      groupForces = nullptr) const
+    {
+        const float twoPi    = 6.28318531f;
+        float       force[2] = { 0.0f, 0.0f };
+        if (groupForces)
+            std::fill(groupForces, groupForces + HapticEffect::groupCount, glm::vec2(0, 0));
+        for (const HapticEffect& e : effects)
+        {
+            if (!(e.group & groups))
+                continue;
+            float x = static_cast<float>(pos[e.handle]) - e.position;
+            float t = std::chrono::duration<float>(now - e.start).count();
+            if (e.duration > 0.0f && (t < 0.0f || t > e.duration))
+                continue;
+            float f = 0.0f;
+            switch (e.type)
+            {
+            case HapticEffect::Spring:
+                if (std::abs(x) > e.width)
+                    f = e.gain * (x > 0.0f ? x - e.width : x + e.width);
+                break;
+            case HapticEffect::Damper:
+                f = e.gain * static_cast<float>(vel[e.handle]);
+                break;
+            case HapticEffect::Detent:
+                if (e.width > 0.0f)  // slope gain in every notch, so gain acts like a spring
+                    f = e.gain * e.width / twoPi * std::sin(twoPi * x / e.width);
+                break;
+            case HapticEffect::Vibration:
+                f = e.gain * std::exp(-e.decay * t) * std::sin(twoPi * e.rate * t);
+                break;
+            case HapticEffect::Impulse:
+                if (t >= 0.0f && t < e.width)
+                    f = e.gain * t / e.width;
+                else if (t >= 0.0f)
+                    f = e.gain * std::exp(-e.decay * (t - e.width));
+                break;
+            }
+            force[e.handle] += f;
+            if (groupForces)
+                groupForces[HapticEffect::groupIndex(e.group)][e.handle] += f;
+        }
+        return glm::vec2(force[0], force[1]);
+    }
+};
@@ -1,9 +1,39 @@
 #pragma once
 
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
 #include <glm/glm.hpp>
+#include "CollisionIndex.hpp"
+#include "FlowField.hpp"
 #include "HandleInterface.hpp"
+#include "HandleProtocol.hpp"
+#include "HapticEffects.hpp"
+#include "RcuPointer.hpp"
+#include "SeqLock.hpp"
+#include "SpscQueue.hpp"
+
+#define COLLISION_QUEUE_SIZE 256 /**< Collision impulses buffered between two haptic updates. */
+#define EFFECT_QUEUE_SIZE 64     /**< Effect changes buffered between two haptic updates. */
+#define COLLISION_ATTACK 0.001f  /**< Rise time of the force pulse of a collision in seconds. */
+#define COLLISION_DECAY 80.0f    /**< Decay of the force pulse in 1/s. */
+#define COLLISION_RING_GAIN 0.5f /**< Ringing of a collision relative to the pulse. */
+#define COLLISION_RING_FREQUENCY 150.0f /**< Frequency of the ringing in Hz. */
+#define COLLISION_RING_DECAY 60.0f      /**< Decay of the ringing in 1/s. */
+#define COLLISION_CUTOFF 0.01f   /**< Fraction of the peak at which a collision transient ends. */
+#define COLLISION_MAX_EFFECTS 32 /**< Collision transients rendered at once. */
+#define PREDICTION_MAX_LEAD std::chrono::milliseconds(20) /**< Longest extrapolation. */
+#define LOCAL_MODEL_RESEND std::chrono::milliseconds(500) /**< Repeats lost model uploads. */
+#define CONTACT_RANGE 0.3 /**< Distance of the ball to a wall in cm, at which contact starts. */
+#define CONTACT_K 5.0     /**< Stiffness of the contact force per cm of closing in on a wall. */
+#define CONTACT_MAX_CANDIDATES 32 /**< Maximum number of walls tested per servo tick. */
+#define CONTACT_MAX_EXTRAPOLATION std::chrono::milliseconds(10) /**< Longest ball extrapolation. */
+#define GUIDANCE_K 0.5 /**< Strength of the force guiding the ball towards the exit. */
+
+static_assert(COLLISION_MAX_EFFECTS + 2 * HANDLE_AXES < HAPTIC_EFFECT_CAPACITY,
+              "the effect table has to hold the collisions beside the springs and the level");
 
 template<typename T>
 int
@@ -12,89 +42,524 @@ sgn(T val)
     return (T(0) < val) - (val < T(0));
 }
 
+/**
+ * Tunables of the haptics. Published as immutable snapshot, so the servo loop reads them without
+ * waiting and any thread can change them at runtime, see HapticForceManager::updateConfig.
+ */
+struct HapticConfig
+{
+    glm::vec2 wallPos          = glm::vec2(-40.0f, 40.0f); /**< Walls of the handle range. */
+    float     wallK            = 0.5f;             /**< Stiffness of the walls. */
+    float     centerSpringK    = 0.01f;            /**< Stiffness of the center spring. */
+    float     centerSpringDead = 10.0f;            /**< Dead band of the center spring. */
+    float     contactK         = CONTACT_K;        /**< Stiffness of the contact force. */
+    float     contactRange     = CONTACT_RANGE;    /**< Distance at which contact starts. */
+    float     guidanceK        = GUIDANCE_K;       /**< Strength of the guidance force. */
+    float     collisionAttack  = COLLISION_ATTACK; /**< Rise time of collision pulses. */
+    float     collisionDecay   = COLLISION_DECAY;  /**< Decay of collision pulses. */
+    float     ringGain         = COLLISION_RING_GAIN;      /**< Ringing of collisions. */
+    float     ringFrequency    = COLLISION_RING_FREQUENCY; /**< Frequency of the ringing. */
+    float     ringDecay        = COLLISION_RING_DECAY;     /**< Decay of the ringing. */
+    bool      enableCenterSpring  = true;
+    bool      enableBallCollision = true;
+    bool      enableWalls         = true;
+    bool      enablePrediction = false; /**< Compute the forces at the predicted positions. */
+    bool      enableOffload    = false; /**< Let the handles render walls and center spring. */
+    bool      enableContact    = true;  /**< Render the labyrinth walls around the ball. */
+    bool      enableGuidance   = false; /**< Guide the ball towards the exit. */
+};
+
 class HapticForceManager
 {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Struct representing a collision of the ball, as peak force it causes on the handles.
+     */
+    struct CollisionImpulse
+    {
+        Clock::time_point time;  /**< Time the collision was calculated by the physics. */
+        glm::vec2         force; /**< Peak force on handle 1 and handle 2. */
+    };
+
+    /**
+     * Struct representing the ball as the physics calculated it last, for the contact forces.
+     */
+    struct BallPose
+    {
+        bool              valid = false;  /**< Set once the physics published a ball. */
+        glm::vec3         centerpoint;    /**< Centerpoint in physics coordination system. */
+        glm::vec3         velocity;       /**< Velocity in cm/s. */
+        float             radius = 0.0f;  /**< Radius in cm. */
+        Clock::time_point time;           /**< Time of the physics step. */
+    };
+
+    /**
+     * Geometry of the current labyrinth, replaced as a whole between two levels.
+     */
+    struct Board
+    {
+        std::shared_ptr<const CollisionIndex> walls;     /**< Walls the contact is rendered from. */
+        std::shared_ptr<const FlowField>      flowField; /**< Way out of the labyrinth. */
+    };
+
+    /**
+     * Change of the effect table, queued by the game loop and applied by the servo loop.
+     */
+    struct EffectChange
+    {
+        uint8_t      removeGroups; /**< Groups to remove, 0 to add effect instead. */
+        HapticEffect effect;       /**< Effect to add. */
+
+        EffectChange() : removeGroups(0), effect(HapticEffect::Spring, 0, 0, 0.0f) {}
+    };
+
 private:
-    mutable std::recursive_mutex mutex;
-    glm::vec2                    ballCollisionForce;
-    glm::vec2                    wallPos;
-    float                        wallK;
-    float                        centerSpringK;
-    float                        centerSpringDead;
+    SpscQueue<CollisionImpulse, COLLISION_QUEUE_SIZE>
+                      collisionImpulses;  /**< Filled by the physics, drained by the haptics. */
+    SpscQueue<EffectChange, EFFECT_QUEUE_SIZE>
+                      effectChanges;      /**< Filled by the game loop, drained by the haptics. */
+    std::atomic<uint64_t>        droppedEffects; /**< Effects the full table could not take. */
     HandleInterface&             handleInterface;
+    std::atomic<double> predictionLead[HANDLE_AXES]; /**< Extrapolation time of the last update in
+                                                        seconds, per axis. */
+    HandleProtocol::LocalModel sentModel; /**< Model last passed to pollLocalModel. */
+    Clock::time_point          modelSent; /**< Time it was passed. */
+    SeqLock<BallPose>          ballPose;  /**< Written by the physics, read by the servo loop. */
+    RcuPointer<Board>          board;     /**< Written by the physics, read by the servo loop. */
+    HapticEffectTable          effects;   /**< Springs, dampers and the like on the handles, owned
+                                               by the servo loop. */
+    RcuPointer<HapticConfig>   config;       /**< Read by the servo loop. */
+    uint64_t                   appliedEpoch; /**< Epoch of the config the springs are set to. */
+    bool                       applied;      /**< appliedEpoch is valid. */
+
+    /**
+     * Applies the effect changes queued by the game loop to the table, in the order they were
+     * queued.
+     */
+    void applyEffectChanges(Clock::time_point now)
+    {
+        EffectChange change;
+        while (effectChanges.pop(change))
+        {
+            if (change.removeGroups != 0)
+                effects.remove(change.removeGroups);
+            else
+            {
+                effects.removeExpired(now);
+                if (!effects.add(change.effect))
+                    droppedEffects.store(droppedEffects.load(std::memory_order_relaxed) + 1,
+                                         std::memory_order_relaxed);
+            }
+        }
+    }
 
-    glm::vec2 getCenterSpringForce()
+    /**
+     * Sets the center spring and the walls in the effect table to the config.
+     */
+    void applyConfig(const HapticConfig& current)
     {
-        auto  pos1 = handleInterface.getPos1();
-        auto  pos2 = handleInterface.getPos2();
-        float force1, force2;
+        effects.remove(HapticEffect::CenterSpring | HapticEffect::Walls);
+        for (uint8_t i = 0; i < HANDLE_AXES; i++)
+        {
+            effects.add(HapticEffect::spring(HapticEffect::CenterSpring,
+                                             i,
+                                             current.centerSpringK,
+                                             0.0f,
+                                             current.centerSpringDead));
+            effects.add(HapticEffect::spring(HapticEffect::Walls,
+                                             i,
+                                             current.wallK,
+                                             0.5f * (current.wallPos.x + current.wallPos.y),
+                                             0.5f * (current.wallPos.y - current.wallPos.x)));
+        }
+    }
 
-        if (std::abs(pos1) > centerSpringDead)
-            force1 = (pos1 - sgn(pos1) * centerSpringDead) * centerSpringK;
-        else
-            force1 = 0.0f;
+    /**
+     * Extrapolates the filtered handle positions to the time the force computed now is applied by
+     * the handles, which is the age of the samples plus the time the force frame takes to the
+     * handle, estimated as half the measured round trip time.
+     */
+    HandleInterface::HandleState predict(HandleInterface::HandleState state, Clock::time_point now)
+    {
+        for (size_t axis = 0; axis < HANDLE_AXES; axis++)
+        {
+            const HandleEstimate& estimate = state.estimate[axis];
+            if (estimate.time == Clock::time_point())
+                continue;  // no sample received yet
+            double roundTrip = 0.0;
+            size_t ports     = 0;
+            for (size_t i = 0; i < handleInterface.getPortCount(); i++)
+                if (handleInterface.getDevice(i).axis == axis)
+                {
+                    roundTrip += handleInterface.getPortStats(i).roundTrip.getMeanUs();
+                    ports++;
+                }
+            double oneWay = ports > 0 ? roundTrip / ports / 2e6 : 0.0;
+            double lead   = std::chrono::duration<double>(now - estimate.time).count() + oneWay;
+            lead = std::min(lead, std::chrono::duration<double>(PREDICTION_MAX_LEAD).count());
+            predictionLead[axis].store(lead, std::memory_order_relaxed);
+            state.pos[axis] = estimate.pos + estimate.vel * lead;
+        }
+        return state;
+    }
+
+    /**
+     * Adds a collision transient, replacing the oldest one if too many overlap.
+     */
+    void addCollisionEffect(HapticEffect effect, Clock::time_point start)
+    {
+        effect.start = start;
+        if (effects.count(HapticEffect::Collision) >= COLLISION_MAX_EFFECTS)
+            effects.removeOldest(HapticEffect::Collision);
+        effects.add(effect);  // only dropped if the effects of the level filled the table
+    }
 
-        if (std::abs(pos2) > centerSpringDead)
-            force2 = (pos2 - sgn(pos2) * centerSpringDead) * centerSpringK;
-        else
-            force2 = 0.0f;
+    /**
+     * Takes over all queued collision impulses as transients in the effect table: a pulse which
+     * rises within the attack time and decays, plus a damped ringing. The transients start at the
+     * time the physics calculated the collision and are evaluated every servo tick, so their shape
+     * does not depend on the rates of the physics, the servo loop or the ports, and overlapping
+     * collisions add up.
+     */
+    void consumeCollisionImpulses(Clock::time_point now, const HapticConfig& current)
+    {
+        const float      cutoff        = std::log(1.0f / COLLISION_CUTOFF);
+        const float      pulseDuration = current.collisionAttack + cutoff / current.collisionDecay;
+        CollisionImpulse impulse;
+        while (collisionImpulses.pop(impulse))
+        {
+            for (uint8_t i = 0; i < HANDLE_AXES; i++)
+            {
+                if (impulse.force[i] == 0.0f)
+                    continue;
+                addCollisionEffect(HapticEffect::impulse(HapticEffect::Collision,
+                                                         i,
+                                                         impulse.force[i],
+                                                         current.collisionDecay,
+                                                         pulseDuration,
+                                                         current.collisionAttack),
+                                   impulse.time);
+                if (current.ringGain > 0.0f)
+                    addCollisionEffect(
+                        HapticEffect::vibration(HapticEffect::Collision,
+                                                i,
+                                                current.ringGain * impulse.force[i],
+                                                current.ringFrequency,
+                                                cutoff / current.ringDecay,
+                                                current.ringDecay),
+                        impulse.time);
+            }
+        }
+        effects.removeExpired(now);
+    }
 
-        return glm::vec2(force1, force2);
+    /**
+     * Reads the ball published by the physics and moves it on to the current time.
+     * @return false if there is no ball.
+     */
+    bool getBall(Clock::time_point now, BallPose& ball)
+    {
+        ball = ballPose.load();
+        if (!ball.valid)
+            return false;
+        float age = std::chrono::duration<float>(
+                        std::min<Clock::duration>(now - ball.time, CONTACT_MAX_EXTRAPOLATION))
+                        .count();
+        ball.centerpoint += ball.velocity * std::max(age, 0.0f);
+        return true;
     }
 
-    glm::vec2 getWallForce()
+    /**
+     * Pulls the ball towards the next cell on the shortest way out, looked up in the flow field.
+     */
+    glm::vec2
+    getGuidanceForce(const FlowField* flowField, const BallPose& ball, const HapticConfig& current)
     {
-        auto      pos1 = handleInterface.getPos1();
-        auto      pos2 = handleInterface.getPos2();
-        glm::vec2 force(0, 0);
-        if (pos1 > wallPos.y)
-            force.x = wallK * (pos1 - wallPos.y);
-        else if (pos1 < wallPos.x)
-            force.x = wallK * (pos1 - wallPos.x);
-        if (pos2 > wallPos.y)
-            force.y = wallK * (pos2 - wallPos.y);
-        else if (pos2 < wallPos.x)
-            force.y = wallK * (pos2 - wallPos.x);
-        return force;
+        glm::vec2 direction;
+        if (!flowField || !flowField->getDirection(ball.centerpoint, direction))
+            return glm::vec2(0.0f, 0.0f);
+        // the handles render the reaction of the board, so the pull along direction is the
+        // reaction of a push against it
+        return boardToHandles(-direction * current.guidanceK);
     }
 
 public:
-    bool enableCenterSpring;
-    bool enableBallCollision;
-    bool enableWalls;
-
-    HapticForceManager(HandleInterface& handleInterface,
-                       glm::vec2        wallPos          = glm::vec2(-40.0f, 40.0f),
-                       float            wallK            = 0.5f,
-                       float            centerSpringK    = 0.01f,
-                       float            centerSpringDead = 10.0f)
-    : handleInterface(handleInterface)
-    , wallPos(wallPos)
-    , wallK(wallK)
-    , centerSpringK(centerSpringK)
-    , centerSpringDead(centerSpringDead)
-    , enableCenterSpring(true)
-    , enableBallCollision(true)
-    , enableWalls(true)
-    {
-    }
-
-    void setBallCollisionForce(const glm::vec2& force)
-    {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        ballCollisionForce = force;
-    }
-
-    glm::vec2 getHandleForce()
-    {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        glm::vec2                             force(0, 0);
-        if (enableBallCollision)
-            force += ballCollisionForce;
-        if (enableCenterSpring)
-            force += getCenterSpringForce();
-        if (enableWalls)
-            force += getWallForce();
+    HapticForceManager(HandleInterface&    handleInterface,
+                       const HapticConfig& config = HapticConfig())
+    : droppedEffects(0)
+    , handleInterface(handleInterface)
+    , config(config)
+    , appliedEpoch(0)
+    , applied(false)
+    {
+        for (uint8_t i = 0; i < HANDLE_AXES; i++)
+            predictionLead[i].store(0.0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns a copy of the current config.
+     */
+    HapticConfig getConfig() { return config.copy(); }
+
+    /**
+     * Changes the config from any thread, without blocking the servo loop. The servo loop picks
+     * the new config up with its next tick.
+     * @param modify Callable taking a HapticConfig& and changing it, applied to a copy of the
+     * current config, which is then published.
+     */
+    template<typename F>
+    void updateConfig(F modify)
+    {
+        config.update(modify);
+    }
+
+    /**
+     * Toggles a switch of the config, e.g. &HapticConfig::enableWalls.
+     */
+    void toggleConfig(bool HapticConfig::*flag)
+    {
+        config.update([flag](HapticConfig& changed) { changed.*flag = !(changed.*flag); });
+    }
+
+    /**
+     * Adds an effect to the table evaluated every servo tick, e.g. for the current level, called
+     * by the game loop only. Never blocks, the servo loop adds it with its next tick, or counts it
+     * in getDroppedEffects if the table is full, see HAPTIC_EFFECT_CAPACITY.
+     * @return false if the queue is full and the effect was dropped.
+     */
+    bool addEffect(const HapticEffect& effect)
+    {
+        EffectChange change;
+        change.effect = effect;
+        return effectChanges.push(change);
+    }
+
+    /**
+     * Removes all effects of the given groups, see HapticEffect::Group, called by the game loop
+     * only. Never blocks, the servo loop removes them with its next tick, in order with addEffect.
+     * @return false if the queue is full and the removal was dropped.
+     */
+    bool removeEffects(uint8_t groups)
+    {
+        EffectChange change;
+        change.removeGroups = groups;
+        return effectChanges.push(change);
+    }
+
+    /**
+     * Returns the number of effects the servo loop could not add because the table was full.
+     */
+    uint64_t getDroppedEffects() const { return droppedEffects.load(std::memory_order_relaxed); }
+
+    /**
+     * Queues the force of a ball collision, called by the physics thread only. Never blocks.
+     * @param force Peak force on handle 1 and handle 2.
+     * @return false if the queue is full and the impulse was dropped.
+     */
+    bool pushCollisionImpulse(const glm::vec2& force)
+    {
+        CollisionImpulse impulse;
+        impulse.time  = Clock::now();
+        impulse.force = force;
+        return collisionImpulses.push(impulse);
+    }
+
+    /**
+     * Returns how far ahead the position of an axis was extrapolated in the last update, in
+     * seconds.
+     */
+    double getPredictionLead(size_t axis) const
+    {
+        return predictionLead[axis].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the walls the contact forces are rendered from and the flow field of the guidance,
+     * nullptr disables them e.g. between two levels. Forgets the ball of the previous geometry.
+     * Called by the thread publishing the ball, or while no ball is published, e.g. when a level
+     * is loaded before the physics thread starts. The servo loop picks the geometry up with its
+     * next tick and the previous one is freed once no tick uses it anymore.
+     */
+    void setBoardGeometry(std::shared_ptr<const CollisionIndex> geometry,
+                          std::shared_ptr<const FlowField>      flowField)
+    {
+        Board changed;
+        changed.walls     = geometry;
+        changed.flowField = flowField;
+        board.store(changed);
+        ballPose.store(BallPose());
+    }
+
+    /**
+     * Publishes the ball after a physics step, called by the physics thread only. Never blocks.
+     */
+    void publishBall(const glm::vec3& centerpoint, const glm::vec3& velocity, float radius)
+    {
+        BallPose ball;
+        ball.valid       = true;
+        ball.centerpoint = centerpoint;
+        ball.velocity    = velocity;
+        ball.radius      = radius;
+        ball.time        = Clock::now();
+        ballPose.store(ball);
+    }
+
+    /**
+     * Returns the walls and the center spring of a config as model for the handle firmware.
+     * Without offload no effect is enabled in it, so the handles only render the streamed forces.
+     */
+    static HandleProtocol::LocalModel getLocalModel(const HapticConfig& config)
+    {
+        HandleProtocol::LocalModel model;
+        model.wallMin          = config.wallPos.x;
+        model.wallMax          = config.wallPos.y;
+        model.wallK            = config.wallK;
+        model.centerSpringK    = config.centerSpringK;
+        model.centerSpringDead = config.centerSpringDead;
+        if (config.enableOffload && config.enableWalls)
+            model.flags |= HandleProtocol::LocalWalls;
+        if (config.enableOffload && config.enableCenterSpring)
+            model.flags |= HandleProtocol::LocalCenterSpring;
+        return model;
+    }
+
+    /**
+     * Maps a force acting on the ball in the x/y plane of the labyrinth onto the handles, which
+     * render its reaction on the board. Collision impulses, wall contact and guidance all use
+     * this mapping, so a wall pushes the handles the same way when the ball hits it and when the
+     * ball rests against it.
+     */
+    static glm::vec2 boardToHandles(const glm::vec2& boardForce)
+    {
+        return glm::vec2(-boardForce.y, boardForce.x);
+    }
+
+    /**
+     * Returns the peak force of a ball collision on the handles.
+     * @param impulse Impulse the wall applied to the ball.
+     * @param velocity Velocity of the ball after the collision.
+     */
+    static glm::vec2 getCollisionForce(const glm::vec3& impulse, const glm::vec3& velocity)
+    {
+        return boardToHandles(glm::vec2(std::abs(impulse.x) * velocity.x,
+                                        std::abs(impulse.y) * velocity.y)
+                              / 10000.0f);
+    }
+
+    /**
+     * Renders the walls of the labyrinth around the ball as springs, which start contactRange
+     * before the ball touches a wall, so resting against a wall and closing in on it are felt.
+     * Only the walls in the grid cells around the ball are tested.
+     * @param walls Walls of the labyrinth.
+     * @return Force on handle 1 and handle 2.
+     */
+    static glm::vec2
+    getContactForce(const CollisionIndex& walls, const BallPose& ball, const HapticConfig& current)
+    {
+        const glm::vec3& center = ball.centerpoint;
+        glm::vec3        reach(ball.radius + current.contactRange);
+
+        uint32_t  candidates[CONTACT_MAX_CANDIDATES];
+        size_t    count
+            = walls.query(center - reach, center + reach, candidates, CONTACT_MAX_CANDIDATES);
+        glm::vec2 boardForce(0.0f, 0.0f);
+        for (size_t i = 0; i < count; i++)
+        {
+            const StaticObject& wall     = walls.getWall(candidates[i]);
+            glm::vec3           closest  = glm::clamp(center, wall.edgepointMin, wall.edgepointMax);
+            glm::vec3           offset   = center - closest;
+            float               distance = glm::length(offset);
+            // the floor below the ball is no wall, neither is a ball inside a wall
+            if (distance <= 0.0f || std::abs(offset.z) > 0.5f * distance)
+                continue;
+            float gap = distance - ball.radius;
+            if (gap < current.contactRange)
+                boardForce += glm::vec2(offset.x, offset.y) / distance * current.contactK
+                              * (current.contactRange - gap);
+        }
+        return boardToHandles(boardForce);
+    }
+
+    /**
+     * Returns the model to upload to the handles, if it changed or was not repeated for a while,
+     * called by the servo loop.
+     * @param model Set to the model to upload.
+     * @return true if the model has to be uploaded.
+     */
+    bool pollLocalModel(Clock::time_point now, HandleProtocol::LocalModel& model)
+    {
+        model = getLocalModel(config.read());
+        if (model == sentModel && now - modelSent < LOCAL_MODEL_RESEND)
+            return false;
+        sentModel = model;
+        modelSent = now;
+        return true;
+    }
+
+    /**
+     * Computes the force of all effects, called by the servo loop once per tick, which is the
+     * only reader of the config and the board and the only owner of the effect table. Takes no
+     * lock, the other threads hand their changes over through lock-free queues and pointers.
+     * @param sample If set, receives the positions and the force of every source for telemetry,
+     * the timing is left to the caller.
+     */
+    glm::vec2 getHandleForce(HapticSample* sample = nullptr)
+    {
+        glm::vec2           force(0, 0);
+        Clock::time_point   now     = Clock::now();
+        uint64_t            epoch   = config.getEpoch();
+        const HapticConfig& current = config.read();
+        if (!applied || epoch != appliedEpoch)
+        {
+            applyConfig(current);
+            appliedEpoch = epoch;
+            applied      = true;
+        }
+        applyEffectChanges(now);
+        consumeCollisionImpulses(now, current);
+        // one snapshot, so all effects see the same positions of both handles
+        HandleInterface::HandleState state = handleInterface.getState();
+        if (current.enablePrediction)
+            state = predict(state, now);
+        // offloaded effects are rendered by the handles at their own loop rate
+        uint8_t groups = HapticEffect::Level;
+        if (current.enableBallCollision)
+            groups |= HapticEffect::Collision;
+        if (current.enableCenterSpring && !current.enableOffload)
+            groups |= HapticEffect::CenterSpring;
+        if (current.enableWalls && !current.enableOffload)
+            groups |= HapticEffect::Walls;
+        double    vel[HANDLE_AXES] = { state.estimate[0].vel, state.estimate[1].vel };
+        glm::vec2 groupForces[HapticEffect::groupCount];
+        force += effects.evaluate(state.pos, vel, groups, now, sample ? groupForces : nullptr);
+        glm::vec2 contact(0, 0), guidance(0, 0);
+        BallPose  ball;
+        if (getBall(now, ball))
+        {
+            const Board& geometry = board.read();
+            if (current.enableContact && geometry.walls)
+                contact = getContactForce(*geometry.walls, ball, current);
+            if (current.enableGuidance)
+                guidance = getGuidanceForce(geometry.flowField.get(), ball, current);
+        }
+        force += contact + guidance;
+        if (sample)
+        {
+            for (size_t axis = 0; axis < HANDLE_AXES; axis++)
+            {
+                sample->pos[axis] = static_cast<float>(state.pos[axis]);
+                sample->vel[axis] = static_cast<float>(vel[axis]);
+                for (size_t group = 0; group < HapticEffect::groupCount; group++)
+                    sample->force[group][axis] = groupForces[group][axis];
+                sample->force[HapticSample::Contact][axis]  = contact[axis];
+                sample->force[HapticSample::Guidance][axis] = guidance[axis];
+                sample->total[axis]                         = force[axis];
+            }
+        }
+        config.quiescent();  // the tick holds no config and no board from here on
+        board.quiescent();
         return force;
     }
 };
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpscQueue.hpp"
+
+#define TELEMETRY_AXES 2            /**< Handle axes per sample, HANDLE_AXES. */
+#define TELEMETRY_QUEUE_SIZE 4096   /**< Servo ticks buffered between two flushes, power of 2. */
+#define TELEMETRY_FLUSH_INTERVAL std::chrono::milliseconds(50) /**< Period of the writer thread. */
+#define TELEMETRY_MOTION_SCALE 1e3  /**< Positions and velocities are stored in 1/1000 units. */
+#define TELEMETRY_FORCE_SCALE 1e5   /**< Forces are stored in 1/100000 units. */
+
+/**
+ * Inputs and outputs of one servo tick of the haptics.
+ */
+struct HapticSample
+{
+    /**
+     * Sources of the force, as rendered by HapticForceManager. The effect groups come first, in
+     * the order of HapticEffect::groupIndex.
+     */
+    enum Component : uint8_t
+    {
+        CenterSpring,
+        Walls,
+        Level,
+        Collision,
+        Contact,
+        Guidance,
+        ComponentCount
+    };
+
+    int64_t timeUs;                        /**< Steady clock time of the wake-up in microseconds. */
+    int32_t lateUs;                        /**< Wake-up after the deadline of the tick. */
+    int32_t computeUs;                     /**< Time from the wake-up until the forces were sent. */
+    float   pos[TELEMETRY_AXES];           /**< Positions the forces were computed at. */
+    float   vel[TELEMETRY_AXES];           /**< Filtered velocities. */
+    float   force[ComponentCount][TELEMETRY_AXES]; /**< Force of each source, 0 if disabled. */
+    float   total[TELEMETRY_AXES];                 /**< Force sent to the handles. */
+};
+
+/**
+ * Streams a HapticSample of every servo tick into a binary file. The servo loop only copies the
+ * sample into a lock-free ring, a background thread compresses the samples and writes them, so
+ * tracing does not disturb the timing it traces.
+ *
+ *     header  4  magic "HTEL"
+ *             2  version
+ *             1  number of axes
+ *             1  number of force components
+ *     sample  every field in the order of HapticSample, as difference to the same field of the
+ *             previous sample, zigzag encoded into a little endian base 128 varint. Times are
+ *             microseconds, positions and velocities scaled by TELEMETRY_MOTION_SCALE and forces
+ *             by TELEMETRY_FORCE_SCALE, rounded to integers.
+ *
+ * Consecutive ticks differ little, so most fields take one or two bytes.
+ */
+class HapticTelemetry
+{
+public:
+    static const uint16_t version    = 1;
+    static const size_t   headerSize = 8;
+
+private:
+    static const size_t fieldCount = 3 + TELEMETRY_AXES * (3 + HapticSample::ComponentCount);
+    static const size_t maxSampleSize = fieldCount * 10; /**< A varint takes up to 10 bytes. */
+
+    SpscQueue<HapticSample, TELEMETRY_QUEUE_SIZE> queue; /**< Filled by the servo loop. */
+    std::atomic<bool>     running; /**< Samples are accepted and written. */
+    std::atomic<uint64_t> written; /**< Samples written to the file. */
+    std::atomic<uint64_t> dropped; /**< Samples dropped because the queue was full. */
+    std::atomic<uint64_t> bytes;   /**< Bytes written to the file. */
+    std::ofstream         file;
+    std::thread           writer;
+    int64_t               previous[fieldCount]; /**< Fields of the last sample, writer thread. */
+
+    /**
+     * Writer thread, flushes the queue to the file periodically until the telemetry is closed.
+     */
+    void run();
+
+    /**
+     * Encodes all queued samples and writes them at once.
+     */
+    void flush(std::vector<uint8_t>& buffer);
+
+    /**
+     * Converts a sample into the integer fields, which are stored.
+     */
+    static void toFields(const HapticSample& sample, int64_t fields[fieldCount]);
+
+    static void fromFields(const int64_t fields[fieldCount], HapticSample& sample);
+
+public:
+    HapticTelemetry();
+    ~HapticTelemetry();
+
+    HapticTelemetry(const HapticTelemetry&) = delete;
+    HapticTelemetry& operator=(const HapticTelemetry&) = delete;
+
+    /**
+     * Creates the file and starts the writer thread.
+     * @return false if the file could not be created.
+     */
+    bool open(const std::string& path);
+
+    /**
+     * Writes the remaining samples and closes the file.
+     */
+    void close();
+
+    bool isOpen() const { return running.load(std::memory_order_relaxed); }
+
+    /**
+     * Queues the sample of a tick, called by the servo loop only. Never blocks, does nothing if
+     * the telemetry is not open.
+     */
+    void push(const HapticSample& sample);
+
+    uint64_t getWritten() const { return written.load(std::memory_order_relaxed); }
+
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * Reads a telemetry file.
+     * @param samples Receives all samples.
+     * @return false if the file cannot be read or is no telemetry of this build.
+     */
+    static bool load(const std::string& path, std::vector<HapticSample>& samples);
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#define LATENCY_HISTOGRAM_BUCKETS 24 /**< Bucket i counts values below 2^i microseconds. */
+
+/**
+ * Histogram of latencies with logarithmic buckets in microseconds.
+ * Recording is wait-free and done by a single thread, any other thread can read the histogram at
+ * the same time.
+ */
+class LatencyHistogram
+{
+private:
+    std::atomic<uint64_t> buckets[LATENCY_HISTOGRAM_BUCKETS]; /**< Number of values per bucket. */
+    std::atomic<uint64_t> count;   /**< Number of recorded values. */
+    std::atomic<uint64_t> sumNs;   /**< Sum of all recorded values in nanoseconds. */
+    std::atomic<uint64_t> maxNs;   /**< Largest recorded value in nanoseconds. */
+
+    static size_t bucketOf(uint64_t ns)
+    {
+        uint64_t us     = ns / 1000;
+        size_t   bucket = 0;
+        while (us > 0 && bucket < LATENCY_HISTOGRAM_BUCKETS - 1)
+        {
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+public:
+    LatencyHistogram() { reset(); }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    /**
+     * Records one value, negative values are counted as zero.
+     */
+    void record(std::chrono::nanoseconds latency)
+    {
+        uint64_t ns = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+        buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumNs.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > maxNs.load(std::memory_order_relaxed))
+            maxNs.store(ns, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sumNs.store(0, std::memory_order_relaxed);
+        maxNs.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+
+    uint64_t getBucket(size_t bucket) const { return buckets[bucket].load(std::memory_order_relaxed); }
+
+    /**
+     * Returns the mean of all recorded values in microseconds.
+     */
+    double getMeanUs() const
+    {
+        uint64_t n = getCount();
+        return n > 0 ? sumNs.load(std::memory_order_relaxed) / 1000.0 / n : 0.0;
+    }
+
+    /**
+     * Returns the largest recorded value in microseconds.
+     */
+    double getMaxUs() const { return maxNs.load(std::memory_order_relaxed) / 1000.0; }
+
+    /**
+     * Returns the upper bound of the bucket, which contains the given quantile, in microseconds.
+     * @param quantile Value between 0.0 and 1.0.
+     */
+    double getQuantileUs(double quantile) const
+    {
+        uint64_t n = getCount();
+        if (n == 0)
+            return 0.0;
+        uint64_t rank = static_cast<uint64_t>(quantile * n);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+        {
+            seen += getBucket(i);
+            if (seen > rank)
+                return static_cast<double>(uint64_t(1) << i);
+        }
+        return getMaxUs();
+    }
+
+    /**
+     * Prints a summary and all non empty buckets.
+     * @param name Name printed in front of the summary.
+     */
+    void print(std::ostream& out, const std::string& name) const
+    {
+        out << name << ": n=" << getCount() << " mean=" << getMeanUs()
+            << "us p99<" << getQuantileUs(0.99) << "us max=" << getMaxUs() << "us" << std::endl;
+        for (size_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+        {
+            uint64_t n = getBucket(i);
+            if (n > 0)
+                out << "  <" << (uint64_t(1) << i) << "us: " << n << std::endl;
+        }
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "HandleProtocol.hpp"
+#include "SerialStats.hpp"
+
+#define LINK_SEND_HISTORY 256 /**< Send times kept to match acknowledgements, power of 2. */
+
+/**
+ * Bookkeeping of the frames exchanged with one handle, shared by the transports: frames lost by
+ * the gaps in the sequence numbers, the one-way jitter by the device timestamps and the round trip
+ * by the acknowledgements in position frames. Used by the IO thread only.
+ */
+class LinkTracker
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    struct SentFrame  // send time of a frame
+    {
+        uint16_t          seq;
+        Clock::time_point time;
+    };
+
+    SerialStats& stats;
+    bool         sequenced;           /**< lastReceivedSeq is valid. */
+    uint16_t     lastReceivedSeq;     /**< Sequence number of the last counted frame. */
+    bool         timed;               /**< minOneWayUs is valid. */
+    int64_t      deviceTimeUs;        /**< Extended timestamp of the last received frame. */
+    uint32_t     lastDeviceTimestamp; /**< Timestamp of the last received frame. */
+    int64_t      minOneWayUs;         /**< Smallest host minus device time seen. */
+    bool         acked;               /**< lastAckSeq is valid. */
+    uint16_t     lastAckSeq;          /**< Sequence number acknowledged last by the device. */
+    SentFrame    sentFrames[LINK_SEND_HISTORY]; /**< Send times by sequence number. */
+
+public:
+    explicit LinkTracker(SerialStats& stats)
+    : stats(stats)
+    , sequenced(false)
+    , lastReceivedSeq(0)
+    , timed(false)
+    , deviceTimeUs(0)
+    , lastDeviceTimestamp(0)
+    , minOneWayUs(0)
+    , acked(false)
+    , lastAckSeq(0)
+    {
+        for (auto& sent : sentFrames)
+            sent.seq = 0;
+    }
+
+    static int64_t toUs(Clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch())
+            .count();
+    }
+
+    /**
+     * Remembers when a frame was sent, to match its acknowledgement.
+     */
+    void frameSent(uint16_t seq, Clock::time_point time)
+    {
+        sentFrames[seq & (LINK_SEND_HISTORY - 1)].seq  = seq;
+        sentFrames[seq & (LINK_SEND_HISTORY - 1)].time = time;
+    }
+
+    /**
+     * Counts the frames missing between the last counted frame and this one, which has to be newer.
+     */
+    void countSequence(uint16_t seq)
+    {
+        if (sequenced)
+            SerialStats::add(stats.framesLost, static_cast<uint16_t>(seq - lastReceivedSeq - 1));
+        sequenced       = true;
+        lastReceivedSeq = seq;
+    }
+
+    /**
+     * Records the one-way jitter and the round trip of a received frame.
+     * @return Delay of the frame in microseconds relative to the fastest one so far.
+     */
+    int64_t measureLatency(const HandleProtocol::FrameView& frame, Clock::time_point now)
+    {  // the clocks of host and device have an unknown offset, so the one-way delay is only known
+       // relative to the fastest frame so far, the device timestamps are extended to 64 bit
+        deviceTimeUs += static_cast<int32_t>(frame.timestamp() - lastDeviceTimestamp);
+        lastDeviceTimestamp = frame.timestamp();
+        int64_t oneWayUs    = toUs(now) - deviceTimeUs;
+        if (!timed || oneWayUs < minOneWayUs)
+            minOneWayUs = oneWayUs;
+        timed = true;
+        stats.oneWayJitter.record(std::chrono::microseconds(oneWayUs - minOneWayUs));
+
+        // a position frame acknowledges the last frame the device received, once
+        if (frame.type() == HandleProtocol::Position && frame.ackDelay() != HandleProtocol::noAck
+            && !(acked && frame.ackSeq() == lastAckSeq))
+        {
+            acked                 = true;
+            lastAckSeq            = frame.ackSeq();
+            const SentFrame& sent = sentFrames[lastAckSeq & (LINK_SEND_HISTORY - 1)];
+            if (sent.seq == lastAckSeq && sent.time != Clock::time_point())
+                stats.roundTrip.record(now - sent.time
+                                       - std::chrono::microseconds(frame.ackDelay()));
+        }
+        return oneWayUs - minOneWayUs;
+    }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "LatencyHistogram.hpp"
+
+/**
+ * Timer waking a loop up periodically, either with relative sleeps or at absolute deadlines.
+ * The lateness of every wake-up against its intended time is recorded in a jitter histogram.
+ */
+class PeriodicTimer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    Clock::duration   period;          /**< Time between two wake-ups. */
+    bool              absolute;        /**< Sleep until absolute deadlines instead of relative. */
+    Clock::time_point deadline;        /**< Intended time of the next wake-up. */
+    uint64_t          missedDeadlines; /**< Number of wake-ups later than a whole period. */
+    LatencyHistogram  jitter;          /**< Lateness of the wake-ups. */
+
+public:
+    /**
+     * Constructor for the timer.
+     * @param period Time between two wake-ups.
+     * @param absolute If set, the timer sleeps until absolute deadlines with clock_nanosleep, so
+     * the time the loop body takes and the sleep overshoot do not accumulate. Otherwise it sleeps
+     * for one period after every loop body.
+     */
+    PeriodicTimer(Clock::duration period, bool absolute);
+
+    /**
+     * Sets the first deadline one period from now.
+     */
+    void start();
+
+    /**
+     * Sleeps until the next wake-up and records its lateness. If a whole period was missed, the
+     * timer skips the missed deadlines instead of catching up with a burst of wake-ups.
+     * @return Time of the wake-up.
+     */
+    Clock::time_point wait();
+
+    /**
+     * Records the wake-up for the current deadline and advances it, for loops which do not sleep
+     * in wait() but are woken up by someone else at getDeadline(), e.g. an event loop.
+     * @param now Time of the wake-up.
+     */
+    void elapsed(Clock::time_point now);
+
+    /**
+     * Returns the intended time of the next wake-up.
+     */
+    Clock::time_point getDeadline() const { return deadline; }
+
+    Clock::duration getPeriod() const { return period; }
+
+    uint64_t getMissedDeadlines() const { return missedDeadlines; }
+
+    const LatencyHistogram& getJitter() const { return jitter; }
+};
@@ -23,8 +23,21 @@
 
 #include "GraphicsModel.hpp"
 #include "HapticForceManager.hpp"
+#include "CollisionIndex.hpp"
+#include "FlowField.hpp"
+#include "SpscQueue.hpp"
+#include "PhysicsWatchdog.hpp"
+#include "SnapshotRing.hpp"
+#include "PeriodicTimer.hpp"
+#include "RealtimeScheduler.hpp"
 
 #define EARTH_ACCEL 981.0 /**< Earth acceleration constant in cm/s^2 */
+#define MAX_COLLISION_CANDIDATES 64 /**< Maximum number of walls tested against a ball per step. */
+#define TRIGGER_EVENT_QUEUE_SIZE 64 /**< Trigger events buffered until the game loop drains them. */
+#define PHYSICS_STEP_BUDGET 0.5 /**< Share of the step time one step may take for calculation. */
+#define SNAPSHOT_CAPACITY 4096 /**< Physics steps kept for rewinding, one snapshot each. */
+#define SNAPSHOT_MAX_BALLS 4   /**< Maximum number of balls stored in a snapshot. */
+#define SNAPSHOT_MAX_CONTACTS 16 /**< Maximum number of contacts stored in a snapshot. */
 
 /**
  * Lock used to synchronize memory, where the physics and the graphics thread access.
@@ -49,32 +62,72 @@ public:
     };
 
     /**
-     * Struct representing a static rigid body object as AABB box.
-     * AABB box according to:
-     * https://developer.mozilla.org/en-US/docs/Games/Techniques/3D_collision_detection
+     * Struct representing a ball entering or leaving a trigger volume.
      */
-    struct StaticObject
+    struct TriggerEvent
     {
-        glm::vec3 edgepointMin; /**< Minimum point of box in physics coordination system. */
-        glm::vec3 edgepointMax; /**< Maximum point of box in physics coordination system. */
+        bool                entered;     /**< True if the ball entered, false if it left. */
+        TriggerVolume::Type type;        /**< Kind of the trigger. */
+        int                 id;          /**< User defined id of the trigger. */
+        size_t              ballIndex;   /**< Index of the ball in the physics scene. */
+        uint64_t            step;        /**< Physics step in which the transition happened. */
+        glm::vec3           centerpoint; /**< Centerpoint of the ball in that step. */
+    };
 
-        /**
-         * Constructor for static AABB box (wall).
-         * @param x1 x value of point1 on plane.
-         * @param y1 y value of point1 on plane.
-         * @param x2 x value of point2 on plane.
-         * @param y2 y value of point2 on plane.
-         * @param floorheight height level of labyrinth floor.
-         * @param wallheight height of labyrinth walls.
-         * @param wallwidth width of labyrinth walls, used to generate AABB box.
-         */
-        StaticObject(float x1,
-                     float y1,
-                     float x2,
-                     float y2,
-                     float floorheight,
-                     float wallheight,
-                     float wallwidth);
+    /**
+     * Struct holding the complete simulation state of a ball, without its references to graphics
+     * and haptics.
+     */
+    struct BallState
+    {
+        glm::vec3 centerpoint;
+        glm::vec3 velocity;
+        glm::vec3 angularMomentum;
+        glm::vec3 omega;
+        float     rotationAngleSimple;
+        glm::vec3 rotationAxisSimple;
+        glm::mat4 rotationMatGraphicsModel;
+        glm::mat3 rotation;
+        glm::mat3 inverseInertiaTensor;
+        glm::vec3 torque;
+    };
+
+    /**
+     * Struct representing a contact between a ball and a wall, which was resolved in a step.
+     */
+    struct Contact
+    {
+        uint32_t  ballIndex;       /**< Index of the ball in the physics scene. */
+        uint32_t  wall;            /**< Index of the wall in the collision index. */
+        glm::vec3 collisionNormal; /**< Normal pointing from the wall to the ball. */
+        float     distance;        /**< Distance between collision point and sphere center. */
+    };
+
+    /**
+     * Struct holding everything a step depends on besides the simulation state. The inputs are
+     * read once at the beginning of the step, so the game loop cannot change them midway.
+     */
+    struct StepInputs
+    {
+        float                  dt;                /**< Time the step advances the simulation by. */
+        float                  pitch, yaw;        /**< Tilt of the labyrinth during the step. */
+        glm::vec3              earthAcceleration; /**< Earth acceleration during the step. */
+        PhysicsWatchdog::Level level;             /**< Degradation level the step ran at. */
+    };
+
+    /**
+     * Struct representing the physics state at the beginning of a step, together with the inputs
+     * and the contacts of that step. Restoring the state and feeding the same inputs calculates
+     * the same step again.
+     */
+    struct Snapshot
+    {
+        uint64_t   step;      /**< Step, at whose beginning the state was captured. */
+        StepInputs inputs;    /**< Inputs of the step. */
+        size_t     ballCount; /**< Number of valid entries in balls. */
+        BallState balls[SNAPSHOT_MAX_BALLS];
+        size_t    contactCount; /**< Number of valid entries in contacts. */
+        Contact   contacts[SNAPSHOT_MAX_CONTACTS];
     };
 
     /**
@@ -107,8 +160,6 @@ public:
 
         glm::vec3 force; /**< Force acting on rigid body. */
 
-        size_t wallCollisionCount;
-
         /**
          * Constructor for rigid body ball object.
          * @param handleInterface interface for the haptic handle
@@ -176,21 +227,33 @@ public:
          * Updates the velocity and the angular velocity of the ball, according to the rigid body
          * collision impulse.
          * @param collision Object of collision.
+         * @param hapticFeedback If the collision is reported to the haptic handles.
          */
-        void updateCollisionImpulse(Collision& collision);
+        void updateCollisionImpulse(Collision& collision, bool hapticFeedback = true);
 
         /**
          * Calculates one rigid body step using the symplectic Euler.
          * @param dt Delta time of this step.
          * @param earthAcceleration Vector describing the earth acceleration for the current step.
+         * @param updateVisualRotation If the rolling rotation of the visual model is updated.
          */
-        void updatePhysics(float dt, glm::vec3 earthAcceleration);
+        void updatePhysics(float dt, glm::vec3 earthAcceleration, bool updateVisualRotation = true);
 
         /**
          * Updates the graphic model according to the new calculated positions and rotations in the
          * physics simulation.
          */
         void updateGraphicsModel();
+
+        /**
+         * Returns the simulation state of the ball.
+         */
+        BallState getState() const;
+
+        /**
+         * Overwrites the simulation state of the ball.
+         */
+        void setState(const BallState& state);
     };
 
 
@@ -205,15 +268,64 @@ private:
     float pitch, yaw; /**< Angles describing the rotation of the labyrinth. Instead of rotating the
                          whole mesh, only the earthAcceleration is rotated.*/
     std::vector<Ball> ballObjects; /**< Container holding all ball objects in the scene */
-    std::vector<StaticObject>
-        walls; /**< Container holding all walls and static objects as AABB boxes. */
+    std::shared_ptr<CollisionIndex> collisionIndex; /**< Walls, static objects and trigger volumes
+                                                       of the scene, shared with the haptics. */
+    std::vector<char> insideTrigger; /**< Per trigger volume, if the ball was inside in the last
+                                        step. */
+    uint64_t stepCount;              /**< Number of physics steps calculated so far. */
+    PhysicsWatchdog watchdog; /**< Watches the step time and degrades the quality on overrun. */
+    RealtimeScheduler::Config realtime; /**< Real-time setup of the physics thread. */
+    PeriodicTimer             timer;    /**< Wakes the physics thread up for every step. */
+    SpscQueue<TriggerEvent, TRIGGER_EVENT_QUEUE_SIZE>
+        triggerEvents; /**< Enter and exit events, produced by the physics thread and consumed by
+                          the game loop. */
+    std::mutex stepMutex; /**< Held while a step is calculated, rewinding waits for it. */
+    SnapshotRing<Snapshot> snapshots;    /**< State and inputs of every step, allocated once. */
+    size_t                 contactCount; /**< Number of valid entries in contacts. */
+    Contact contacts[SNAPSHOT_MAX_CONTACTS]; /**< Contacts resolved in the current step. */
+
+    /**
+     * Reads the tilt set by the game loop and the level the watchdog currently allows.
+     * @param stepTime Time to advance the simulation by.
+     */
+    StepInputs readInputs(float stepTime);
+
+    /**
+     * Calculates one physics step with collisions, integration and trigger volumes. Depends only
+     * on the simulation state and the inputs, so a step is calculated again exactly.
+     * @param inputs Inputs of the step, see readInputs.
+     * @param replay If set, the step is a resimulation: no snapshot is captured, no trigger events
+     * are queued and no haptic feedback is given.
+     */
+    void step(const StepInputs& inputs, bool replay = false);
+
+    /**
+     * Fills a snapshot with the current state and the inputs of the upcoming step.
+     */
+    void captureSnapshot(Snapshot& snapshot, const StepInputs& inputs);
+
+    /**
+     * Restores the simulation state of a snapshot, has to be called with stepMutex held. The
+     * tilt stays as set by the game loop.
+     */
+    void restoreSnapshot(const Snapshot& snapshot);
+
+    /**
+     * Tests the ball against all trigger volumes and queues an event for every volume the ball
+     * entered or left in this step.
+     */
+    void handleTriggers();
 
 public:
     /**
      * Constructor for game physics.
      * @param dt Delta time in which one physics step should be calculated.
+     * @param realtime Real-time setup of the physics thread. If enabled, the steps are timed with
+     * absolute deadlines.
      */
-    Physics(HapticForceManager& hapticForceManager, float dt = 0.001);
+    Physics(HapticForceManager&              hapticForceManager,
+            float                            dt       = 0.001,
+            const RealtimeScheduler::Config& realtime = RealtimeScheduler::Config());
 
     /**
      * Adds ball to physics scene.
@@ -232,11 +344,25 @@ public:
 
     /**
      * Loads file for collision geometries and adds AABB boxes for all walls and the floor of the
-     * labyrinth.
+     * labyrinth. Adds goal trigger volumes below the floor level around the labyrinth, which are
+     * entered when the ball leaves the labyrinth through its exit.
      * @param file Path to file in which the collision geometries are indicated.
      */
     void addWalls(std::string file);
 
+    /**
+     * Adds a trigger volume to the physics scene, has to be called before the physics thread is
+     * started.
+     * @param type Kind of the trigger.
+     * @param id User defined id, reported with every event of this trigger.
+     * @param edgepointMin Minimum point of the volume in physics coordination system.
+     * @param edgepointMax Maximum point of the volume in physics coordination system.
+     */
+    void addTrigger(TriggerVolume::Type type,
+                    int                 id,
+                    const glm::vec3&    edgepointMin,
+                    const glm::vec3&    edgepointMax);
+
     /**
      * Set rotation of earth acceleration vector around x axis and y axis.
      * @param pitch Absolute rotation angle around x axis.
@@ -247,13 +373,16 @@ public:
     /**
      * Checks if there are collisions and updates the position, the velocity and the angular
      * velocity of the ball object.
+     * @param hapticFeedback If collisions are reported to the haptic handles.
      */
-    void handleCollisions();
+    void handleCollisions(bool hapticFeedback = true);
 
     /**
      * Loop function called by the physics thread.
      * Handles all collisions, updates the physics and let the thread sleep for the physics step
-     * time.
+     * time. The calculation time of every step is reported to the watchdog. Applies the real-time
+     * setup to the calling thread first. When the loop is left, removes the walls of the level
+     * from the haptics and prints the wake-up jitter.
      */
     void update();
 
@@ -264,12 +393,45 @@ public:
     void updateGraphicsModel();
 
     /**
-     * Returns centerpoint of ball.
+     * Takes the oldest trigger event, which the physics thread queued. Does not block the physics
+     * thread, should be called by the game loop only.
+     * @param event Receives the event.
+     * @return false if no event is pending.
      */
-    bool inGame() const;
+    bool pollTriggerEvent(TriggerEvent& event);
 
     /**
      * Let the physics thread leave the loop of the update function, ends physics calculation.
      */
     void quitPhysics();
+
+    /**
+     * Returns the histogram of how late the physics thread woke up for its steps.
+     */
+    const LatencyHistogram& getWakeUpJitter() const { return timer.getJitter(); }
+
+    /**
+     * Returns the number of physics steps calculated so far.
+     */
+    uint64_t getStepCount();
+
+    /**
+     * Rewinds the simulation to the newest snapshot captured at or before a step. Snapshots newer
+     * than that are discarded, the physics thread continues from the restored state.
+     * @param step Step to rewind to.
+     * @return false if no snapshot that old is available.
+     */
+    bool rewind(uint64_t step);
+
+    /**
+     * Restores the snapshot of a step and calculates the following steps again with the recorded
+     * inputs, e.g. to reproduce collision glitches. Blocks the physics thread while running.
+     * Afterwards the state from before the call is restored, the captured snapshots are kept.
+     * @param fromStep Step to start the resimulation at, has to be captured.
+     * @param toStep Step to stop the resimulation at.
+     * @param divergence Receives the distance between the resimulated and the captured ball
+     * position at toStep, if toStep is captured.
+     * @return Number of steps calculated.
+     */
+    uint64_t resimulate(uint64_t fromStep, uint64_t toStep, float* divergence = nullptr);
 };
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define WATCHDOG_WINDOW 250            /**< Number of steps evaluated together. */
+#define WATCHDOG_DEGRADE_RATIO 0.2     /**< Overrun ratio of a window, which degrades one level. */
+#define WATCHDOG_RECOVER_RATIO 0.01    /**< Overrun ratio of a window, which counts as calm. */
+#define WATCHDOG_RECOVER_WINDOWS 20    /**< Calm windows in a row, needed to recover one level. */
+
+/**
+ * Class watching the time the physics steps take compared to their time budget.
+ * The steps are evaluated in windows of a fixed number of steps. If too many steps of a window
+ * overran the budget, the physics is degraded by one level. After a number of calm windows in a
+ * row, it recovers again by one level.
+ */
+class PhysicsWatchdog
+{
+public:
+    /**
+     * Degradation levels, in the order they are applied under sustained overrun.
+     */
+    enum Level
+    {
+        Nominal = 0,      /**< Full quality. */
+        NoVisualRotation, /**< Rolling rotation of the visual ball model is not updated. */
+        CoarseCollisions, /**< Collisions are only handled every second step. */
+        LevelCount
+    };
+
+private:
+    float    budget;         /**< Time budget of one step in seconds. */
+    size_t   window;         /**< Number of steps per window. */
+    float    degradeRatio;   /**< Overrun ratio of a window which degrades one level. */
+    float    recoverRatio;   /**< Overrun ratio of a window which counts as calm. */
+    size_t   recoverWindows; /**< Calm windows in a row needed to recover one level. */
+    Level    level;          /**< Current degradation level. */
+    size_t   windowSteps;    /**< Steps recorded in the current window. */
+    size_t   windowOverruns; /**< Overruns in the current window. */
+    float    windowMaxTime;  /**< Slowest step of the current window. */
+    size_t   calmWindows;    /**< Calm windows in a row. */
+    uint64_t totalSteps;     /**< Steps recorded overall. */
+    uint64_t totalOverruns;  /**< Overruns recorded overall. */
+
+    /**
+     * Evaluates a finished window and changes the level if necessary.
+     */
+    void evaluateWindow();
+
+public:
+    /**
+     * Constructor for the watchdog.
+     * @param budget Time budget of one step in seconds.
+     * @param window Number of steps evaluated together.
+     * @param degradeRatio Ratio of overrunning steps in a window, which degrades one level.
+     * @param recoverRatio Ratio of overrunning steps in a window, which counts as calm.
+     * @param recoverWindows Number of calm windows in a row, which recovers one level.
+     */
+    PhysicsWatchdog(float  budget,
+                    size_t window         = WATCHDOG_WINDOW,
+                    float  degradeRatio   = WATCHDOG_DEGRADE_RATIO,
+                    float  recoverRatio   = WATCHDOG_RECOVER_RATIO,
+                    size_t recoverWindows = WATCHDOG_RECOVER_WINDOWS);
+
+    /**
+     * Records the time one physics step took.
+     * @param stepTime Actual computation time of the step in seconds.
+     */
+    void record(float stepTime);
+
+    Level getLevel() const { return level; }
+
+    float getBudget() const { return budget; }
+
+    uint64_t getTotalSteps() const { return totalSteps; }
+
+    uint64_t getTotalOverruns() const { return totalOverruns; }
+
+    /**
+     * Returns a human readable name of a level.
+     */
+    static const char* levelName(Level level);
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * Read-copy-update publication of an immutable value to one reader thread.
+ * The reader gets the current value with one atomic load, without ever waiting. Writers publish a
+ * modified copy by swapping the pointer and exclude each other with a mutex. A replaced value is
+ * freed once the reader passed a quiescent point after the swap, so it cannot hold it anymore.
+ * @tparam T Value type, treated as immutable once published.
+ */
+template<typename T>
+class RcuPointer
+{
+private:
+    std::atomic<const T*> current;     /**< Published value. */
+    std::atomic<uint64_t> epoch;       /**< Number of publications so far. */
+    std::atomic<uint64_t> readerEpoch; /**< Epoch the reader saw at its last quiescent point. */
+    std::mutex            writeMutex;  /**< Excludes writers from each other. */
+    std::vector<std::pair<uint64_t, const T*>> retired; /**< Replaced values by their epoch. */
+
+    void reclaim()
+    {  // a value replaced in epoch e is unreachable once the reader announced an epoch >= e
+        uint64_t seen = readerEpoch.load(std::memory_order_acquire);
+        size_t   kept = 0;
+        for (auto& value : retired)
+        {
+            if (value.first <= seen)
+                delete value.second;
+            else
+                retired[kept++] = value;
+        }
+        retired.resize(kept);
+    }
+
+public:
+    explicit RcuPointer(const T& value = T())
+    : current(new T(value)), epoch(0), readerEpoch(0)
+    {
+    }
+
+    ~RcuPointer()
+    {
+        for (auto& value : retired)
+            delete value.second;
+        delete current.load(std::memory_order_relaxed);
+    }
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    /**
+     * Returns the current value, called by the reader thread only. Wait-free. The value stays
+     * valid until the reader calls quiescent.
+     */
+    const T& read() const { return *current.load(std::memory_order_acquire); }
+
+    /**
+     * Returns the number of publications so far. Read before read(), the value is at least as new
+     * as the epoch.
+     */
+    uint64_t getEpoch() const { return epoch.load(std::memory_order_acquire); }
+
+    /**
+     * Announces that the reader holds no value returned by read before, called by the reader
+     * thread only, e.g. at the end of every loop iteration.
+     */
+    void quiescent()
+    {
+        readerEpoch.store(epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * Returns a copy of the current value, for any thread.
+     */
+    T copy()
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        return *current.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Publishes a copy of the current value modified by a callable, other writers are excluded
+     * for the duration of the call, so no modification gets lost. Frees the values the reader
+     * cannot hold anymore.
+     * @param modify Callable taking a T& and changing it.
+     */
+    template<typename F>
+    void update(F modify)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        std::unique_ptr<T>          value(new T(*current.load(std::memory_order_relaxed)));
+        modify(*value);
+        retired.reserve(retired.size() + 1);  // so the swap cannot be followed by a failure
+        const T* replaced = current.exchange(value.release(), std::memory_order_acq_rel);
+        retired.emplace_back(epoch.fetch_add(1, std::memory_order_acq_rel) + 1, replaced);
+        reclaim();
+    }
+
+    /**
+     * Publishes a new value.
+     */
+    void store(const T& value)
+    {
+        update([&value](T& published) { published = value; });
+    }
+};
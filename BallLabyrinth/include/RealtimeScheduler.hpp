@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+#define REALTIME_DEFAULT_PRIORITY 80 /**< Default SCHED_FIFO priority of real-time threads. */
+
+/**
+ * Switches the calling thread to real-time operation. Every part that cannot be applied, e.g.
+ * because the process lacks the privileges, is reported and skipped, so the thread always keeps
+ * running with whatever could be set up.
+ */
+class RealtimeScheduler
+{
+public:
+    /**
+     * Struct describing the real-time setup of a thread.
+     */
+    struct Config
+    {
+        bool enabled    = false; /**< Use absolute deadlines and apply the settings below. */
+        int  priority   = REALTIME_DEFAULT_PRIORITY; /**< SCHED_FIFO priority, 0 keeps the
+                                                        normal scheduler. */
+        int  cpu        = -1;    /**< CPU the thread is pinned to, -1 for no pinning. */
+        bool lockMemory = true;  /**< Lock all current and future pages of the process in RAM. */
+    };
+
+    /**
+     * Applies the configuration to the calling thread.
+     * @param config Real-time setup, nothing is done if it is not enabled.
+     * @param name Name of the thread, used in the log messages.
+     * @return true if every requested setting could be applied.
+     */
+    static bool apply(const Config& config, const std::string& name);
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HandleProtocol.hpp"
+#include "HandleRecorder.hpp"
+#include "HandleTransport.hpp"
+#include "SerialStats.hpp"
+
+/**
+ * Feeds the position samples of one device of a recording back as if they were received from the
+ * handle, with their original device timestamps, so the filters see the same input as in the
+ * recorded session. Forces written to the transport are dropped, the recording already contains
+ * how the player reacted to them.
+ */
+class ReplayTransport : public HandleTransport
+{
+public:
+    /**
+     * Constructor, loads the recording and starts the replay.
+     * @param device Index of the recorded device to replay.
+     * @throws std::runtime_error if the recording cannot be read or has no samples of the device.
+     */
+    ReplayTransport(boost::asio::io_service& ioService,
+                    const std::string&       path,
+                    size_t                   device,
+                    FrameCallback            readCallback,
+                    SerialStats&             stats)
+    : ioService(ioService)
+    , timer(ioService)
+    , readCallback(readCallback)
+    , stats(stats)
+    , next(0)
+    , seq(0)
+    {
+        std::vector<HandleRecord> records;
+        if (!HandleRecorder::load(path, records))
+            throw std::runtime_error("cannot read recording " + path);
+        for (auto& record : records)
+            if (record.type == HandleProtocol::Position && record.device == device)
+                samples.push_back(record);
+        if (samples.empty())
+            throw std::runtime_error(path + " has no samples of handle " + std::to_string(device));
+        start = std::chrono::steady_clock::now();
+        schedule();
+    }
+
+    void write(double) override { SerialStats::add(stats.framesSent, 1); }
+
+    bool send(HandleProtocol::FrameType, const uint8_t*, size_t) override
+    {
+        SerialStats::add(stats.framesSent, 1);
+        return true;
+    }
+
+    void close() override
+    {
+        ioService.post([this]() {
+            active = false;
+            timer.cancel();
+        });
+    }
+
+private:
+    void schedule()
+    {  // wait for the next sample
+        if (next >= samples.size())
+        {
+            active = false;  // end of the recording, stops the IO thread like a failed port
+            return;
+        }
+        timer.expires_at(start + std::chrono::microseconds(samples[next].timeUs));
+        timer.async_wait(
+            boost::bind(&ReplayTransport::deliver, this, boost::asio::placeholders::error));
+    }
+
+    void deliver(const boost::system::error_code& error)
+    {  // pass all samples which are due as frames, the same way a port passes received frames
+        if (error || !active)
+            return;
+        auto    now = std::chrono::steady_clock::now();
+        uint8_t frame[HandleProtocol::maxFrameSize];
+        for (; next < samples.size(); next++)
+        {
+            if (start + std::chrono::microseconds(samples[next].timeUs) > now)
+                break;
+            size_t size = HandleProtocol::encodePosition(frame,
+                                                         seq++,
+                                                         samples[next].deviceTimestamp,
+                                                         samples[next].value,
+                                                         0,
+                                                         HandleProtocol::noAck);
+            SerialStats::add(stats.bytesReceived, size);
+            SerialStats::add(stats.framesReceived, 1);
+            readCallback(HandleProtocol::FrameView(frame));
+        }
+        schedule();
+    }
+
+    boost::asio::io_service&              ioService;
+    boost::asio::steady_timer             timer; /**< Expires at the next sample in real time. */
+    FrameCallback                         readCallback;
+    SerialStats&                          stats;
+    std::vector<HandleRecord>             samples;  /**< Position samples of the device. */
+    size_t                                next;     /**< Index of the next sample to deliver. */
+    uint16_t                              seq;      /**< Sequence number of the next frame. */
+    std::chrono::steady_clock::time_point start;    /**< Time the replay started. */
+};
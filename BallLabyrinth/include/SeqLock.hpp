@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Sequence lock publishing a small trivially copyable value.
+ * Readers never block writers, they retry if a write happened during their read and always get a
+ * consistent copy. Writers exclude each other with a short spin on the sequence counter.
+ * The value is stored in atomic words, so concurrent reads and writes are free of data races.
+ * @tparam T Trivially copyable value type.
+ */
+template<typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+private:
+    static const size_t wordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> sequence;         /**< Odd while a write is in progress. */
+    std::atomic<uint64_t> words[wordCount]; /**< Value split into atomic words. */
+
+    uint32_t beginWrite()
+    {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        while ((seq & 1) != 0
+               || !sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire))
+            seq = sequence.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    void readWords(T& value) const
+    {
+        uint64_t buffer[wordCount];
+        for (size_t i = 0; i < wordCount; i++)
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+        std::memcpy(&value, buffer, sizeof(T));
+    }
+
+    void writeWords(const T& value)
+    {
+        uint64_t buffer[wordCount] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (size_t i = 0; i < wordCount; i++)
+            words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+
+public:
+    explicit SeqLock(const T& value = T()) : sequence(0)
+    {
+        for (auto& word : words)
+            word.store(0, std::memory_order_relaxed);
+        writeWords(value);
+    }
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    /**
+     * Returns a consistent copy of the value, never blocks a writer.
+     */
+    T load() const
+    {
+        T value;
+        while (true)
+        {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            if ((before & 1) == 0)
+            {
+                readWords(value);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before)
+                    return value;
+            }
+        }
+    }
+
+    /**
+     * Replaces the value.
+     */
+    void store(const T& value)
+    {
+        uint32_t seq = beginWrite();
+        writeWords(value);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * Modifies the value in place, e.g. to change a single member. Other writers are excluded for
+     * the duration of the call.
+     * @param modify Callable taking a T& and changing it.
+     */
+    template<typename F>
+    void update(F modify)
+    {
+        uint32_t seq = beginWrite();
+        T        value;
+        readWords(value);
+        modify(value);
+        writeWords(value);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+};
@@ -5,21 +5,42 @@
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/thread.hpp>
-#include <deque>
+#include <atomic>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+
+#include "HandleProtocol.hpp"
+#include "HandleTransport.hpp"
+#include "LinkTracker.hpp"
+#include "SerialStats.hpp"
+#include "SpscQueue.hpp"
+
+#define SERIAL_WRITE_QUEUE_SIZE 16 /**< Frames other than force commands waiting to be sent. */
 
 #ifdef POSIX
 #include <termios.h>
 #endif
 
-class SerialCommunication
+class SerialCommunication : public HandleTransport
 {
 public:
-    SerialCommunication(boost::asio::io_service&                 ioService,
-                        unsigned int                             baud,
-                        const std::string&                       device,
-                        std::function<void(const char*, size_t)> readCallback)
-    : active(true), ioService(ioService), serialPort(ioService, device), readCallback(readCallback)
+    SerialCommunication(boost::asio::io_service& ioService,
+                        unsigned int             baud,
+                        const std::string&       device,
+                        FrameCallback            readCallback,
+                        SerialStats&             stats)
+    : ioService(ioService)
+    , serialPort(ioService, device)
+    , readFill(0)
+    , readCallback(readCallback)
+    , writeInProgress(false)
+    , writeScheduled(false)
+    , forcePending(false)
+    , pendingForce(0.0)
+    , writeSeq(0)
+    , link(stats)
+    , stats(stats)
     {
         if (!serialPort.is_open())
         {
@@ -31,83 +52,148 @@ public:
         readStart();
     }
 
-    void write(int32_t val)  // pass the write data to the doWrite function via the io service
-                             // in the other thread
-    {
-        ioService.post(boost::bind(&SerialCommunication::doWrite, this, val));
+    void write(double force) override
+    {  // set the force to send, a force which was not sent yet is replaced by the newer one, so a
+       // stalled port sends no outdated forces
+        pendingForce.store(force, std::memory_order_relaxed);
+        forcePending.store(true, std::memory_order_release);
+        scheduleWrite();
+    }
+
+    bool send(HandleProtocol::FrameType type, const uint8_t* payload, size_t size) override
+    {  // queue a frame, which is sent in order with the others, only one thread may call this
+        OutgoingFrame frame;
+        if (size > HandleProtocol::maxPayload)
+            return false;
+        frame.type = type;
+        frame.size = static_cast<uint8_t>(size);
+        std::memcpy(frame.payload, payload, size);
+        if (!writeQueue.push(frame))
+            return false;  // the port does not keep up
+        scheduleWrite();
+        return true;
     }
 
-    void close()  // call the doClose function via the io service in the other thread
+    void close() override  // call the doClose function via the io service in the other thread
     {
         ioService.post(
             boost::bind(&SerialCommunication::doClose, this, boost::system::error_code()));
     }
 
-    bool active;  // remains true while this object is still operating
+    const HandleProtocol::ParseStats& getParseStats() const { return parseStats; }
+
+    static uint32_t timestampUs()  // host timestamp as sent in the frames
+    {
+        return static_cast<uint32_t>(LinkTracker::toUs(std::chrono::steady_clock::now()));
+    }
 
 private:
-    static const int maxReadLength = 512;  // maximum amount of data to read in one operation
+    static const int readBufferSize = 512;  // size of the receive buffer, holds several frames
+    static const int maxWriteLength = 512;  // maximum amount of data to write in one operation
+
+    struct OutgoingFrame  // frame waiting in the write queue, encoded when it is written
+    {
+        HandleProtocol::FrameType type;
+        uint8_t                   size;
+        uint8_t                   payload[HandleProtocol::maxPayload];
+    };
 
     void readStart(void)
-    {  // Start an asynchronous read and call readComplete when it completes or fails
-        serialPort.async_read_some(boost::asio::buffer(readMsg, maxReadLength),
-                                   boost::bind(&SerialCommunication::readComplete,
-                                               this,
-                                               boost::asio::placeholders::error,
-                                               boost::asio::placeholders::bytes_transferred));
+    {  // Start an asynchronous read behind the bytes of a partially received frame and call
+       // readComplete when it completes or fails
+        serialPort.async_read_some(
+            boost::asio::buffer(readMsg + readFill, readBufferSize - readFill),
+            boost::bind(&SerialCommunication::readComplete,
+                        this,
+                        boost::asio::placeholders::error,
+                        boost::asio::placeholders::bytes_transferred));
     }
 
     void readComplete(const boost::system::error_code& error, size_t bytes_transferred)
     {  // the asynchronous read operation has now completed or failed and returned an error
         if (!error)
-        {  // read completed, so process the data
-            readCallback(readMsg, bytes_transferred);
-            /* std::cout << *((int*) readMsg) / 1000000.0 << std::endl; */
-            /* readStart();  // start waiting for another asynchronous read again */
+        {  // read completed, so process the frames in place, they may be split over several reads
+            SerialStats::add(stats.bytesReceived, bytes_transferred);
+            readFill += bytes_transferred;
+            size_t consumed = HandleProtocol::parse(
+                readMsg,
+                readFill,
+                [this](const HandleProtocol::FrameView& frame) { frameReceived(frame); },
+                &parseStats);
+            stats.crcErrors.store(parseStats.crcErrors, std::memory_order_relaxed);
+            // only the bytes of an incomplete frame are left, which are less than a frame
+            readFill -= consumed;
+            std::memmove(readMsg, readMsg + consumed, readFill);
+            readStart();  // start waiting for another asynchronous read again
         }
         else
             doClose(error);
     }
 
-    void doWrite(int32_t val)
+    void frameReceived(const HandleProtocol::FrameView& frame)
+    {  // a serial line keeps the order, so every gap in the sequence numbers is a lost frame
+        link.countSequence(frame.seq());
+        SerialStats::add(stats.framesReceived, 1);
+        link.measureLatency(frame, std::chrono::steady_clock::now());
+        readCallback(frame);
+    }
+
+    void scheduleWrite()
+    {  // pass the write to the doWrite function via the io service in the other thread, but only
+       // if it was not passed already
+        if (!writeScheduled.exchange(true, std::memory_order_acq_rel))
+            ioService.post(boost::bind(&SerialCommunication::doWrite, this));
+    }
+
+    void doWrite()
     {  // callback to handle write call from outside this class
-        bool write_in_progress = !writeMsg.empty();  // is there anything currently being written?
-        for (size_t i = 0; i < sizeof(int32_t); ++i)
-            writeMsg.push_back(((char*) &val)[i]);
-        if (!write_in_progress)  // if nothing is currently being written, then start
+        writeScheduled.store(false, std::memory_order_release);
+        if (!writeInProgress)  // if nothing is currently being written, then start, otherwise the
+                               // completion of the current write picks the data up
             write_start();
     }
 
     void write_start(void)
-    {  // Start an asynchronous write and call writeComplete when it completes or fails
-        if (writeMsg.size() >= 4)
-        {
-            char buffer[4];
-            buffer[0] = writeMsg.back();
-            writeMsg.pop_back();
-            buffer[1] = writeMsg.back();
-            writeMsg.pop_back();
-            buffer[2] = writeMsg.back();
-            writeMsg.pop_back();
-            buffer[3] = writeMsg.back();
-            writeMsg.pop_back();
-            boost::asio::async_write(serialPort,
-                                     boost::asio::buffer(buffer, 4),
-                                     boost::bind(&SerialCommunication::writeComplete,
-                                                 this,
-                                                 boost::asio::placeholders::error));
-            /* std::this_thread::sleep_for(std::chrono::milliseconds(7)); */
-        }
+    {  // Start an asynchronous write of all pending frames at once and call writeComplete when it
+       // completes or fails, the frames are encoded just now, so they carry fresh timestamps
+        size_t        size      = 0;
+        auto          now       = std::chrono::steady_clock::now();
+        uint32_t      timestamp = static_cast<uint32_t>(LinkTracker::toUs(now));
+        uint16_t      firstSeq  = writeSeq;
+        OutgoingFrame frame;
+        // leaves room for the force frame
+        while (size + 2 * HandleProtocol::maxFrameSize <= maxWriteLength && writeQueue.pop(frame))
+            size += HandleProtocol::encode(
+                writeBuffer + size, frame.type, writeSeq++, timestamp, frame.payload, frame.size);
+        if (forcePending.exchange(false, std::memory_order_acquire))
+            size += HandleProtocol::encodeValue(writeBuffer + size,
+                                                HandleProtocol::Force,
+                                                writeSeq++,
+                                                timestamp,
+                                                pendingForce.load(std::memory_order_relaxed));
+        writeInProgress = size > 0;
+        if (!writeInProgress)
+            return;
+        SerialStats::add(stats.framesSent, static_cast<uint16_t>(writeSeq - firstSeq));
+        for (uint16_t seq = firstSeq; seq != writeSeq; seq++)
+            link.frameSent(seq, now);
+        writeStartTime = now;
+        // the buffer has to stay valid until the write completed
+        boost::asio::async_write(serialPort,
+                                 boost::asio::buffer(writeBuffer, size),
+                                 boost::bind(&SerialCommunication::writeComplete,
+                                             this,
+                                             boost::asio::placeholders::error,
+                                             boost::asio::placeholders::bytes_transferred));
     }
 
-    void writeComplete(const boost::system::error_code& error)
+    void writeComplete(const boost::system::error_code& error, size_t bytes_transferred)
     {  // the asynchronous read operation has now completed or failed and returned an error
         if (!error)
-        {                           // write completed, so send next write data
-            /* writeMsg.pop_front();   // remove the completed data */
-            if (!writeMsg.empty())  // if there is anthing left to be written
-                write_start();      // then start sending the next item in the buffer
-            readStart();
+        {  // write completed, so send what was written in the meantime, if anything
+            stats.writeLatency.record(std::chrono::steady_clock::now() - writeStartTime);
+            SerialStats::add(stats.bytesSent, bytes_transferred);
+            write_start();
         }
         else
             doClose(error);
@@ -127,9 +213,20 @@ private:
     }
 
 private:
-    boost::asio::io_service& ioService;   // the main IO service that runs this connection
-    boost::asio::serial_port serialPort;  // the serial port this instance is connected to
-    char                     readMsg[maxReadLength];  // data read from the socket
-    std::deque<char>         writeMsg;                // buffered write data
-    std::function<void(const char*, size_t)> readCallback;
+    boost::asio::io_service&   ioService;  // the main IO service that runs this connection
+    boost::asio::serial_port   serialPort;  // the serial port this instance is connected to
+    uint8_t                    readMsg[readBufferSize];  // data read from the socket
+    size_t                     readFill;  // number of bytes in readMsg, which are not parsed yet
+    uint8_t                    writeBuffer[maxWriteLength];  // data of the write in progress
+    FrameCallback              readCallback;  // called with views into readMsg, without copies
+    bool                       writeInProgress;  // writeBuffer is being written
+    std::atomic<bool>          writeScheduled;  // doWrite is posted to the io service
+    std::atomic<bool>          forcePending;  // pendingForce was not sent yet
+    std::atomic<double>        pendingForce;  // latest force passed to write
+    SpscQueue<OutgoingFrame, SERIAL_WRITE_QUEUE_SIZE> writeQueue;  // frames passed to send
+    HandleProtocol::ParseStats parseStats;  // counters of the receive path
+    uint16_t                   writeSeq;  // sequence number of the next sent frame
+    LinkTracker                link;  // lost frames, round trip and jitter of the received frames
+    std::chrono::steady_clock::time_point writeStartTime;  // time the current write started
+    SerialStats&               stats;  // counters of this port, readable at runtime
 };
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "LatencyHistogram.hpp"
+
+/**
+ * Counters of one handle port, written by the IO thread and readable by any thread at runtime.
+ */
+struct SerialStats
+{
+    std::atomic<uint64_t> bytesReceived;  /**< Bytes read from the port. */
+    std::atomic<uint64_t> bytesSent;      /**< Bytes written to the port. */
+    std::atomic<uint64_t> framesReceived; /**< Frames with a valid checksum. */
+    std::atomic<uint64_t> framesSent;     /**< Frames written to the port. */
+    std::atomic<uint64_t> framesLost;     /**< Gaps in the sequence numbers of received frames. */
+    std::atomic<uint64_t> framesLate;     /**< Frames dropped for arriving behind newer ones. */
+    std::atomic<uint64_t> crcErrors;      /**< Frames dropped because of a wrong checksum. */
+    LatencyHistogram      writeLatency;   /**< Time from starting a write to its completion. */
+    LatencyHistogram      roundTrip;      /**< Time from sending a frame to its acknowledgement,
+                                               without the time the device held the ack back. */
+    LatencyHistogram      oneWayJitter;   /**< Delay of received frames relative to the fastest
+                                               one, based on the timestamps of the device. */
+
+    SerialStats()
+    : bytesReceived(0)
+    , bytesSent(0)
+    , framesReceived(0)
+    , framesSent(0)
+    , framesLost(0)
+    , framesLate(0)
+    , crcErrors(0)
+    {
+    }
+
+    SerialStats(const SerialStats&) = delete;
+    SerialStats& operator=(const SerialStats&) = delete;
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {  // only the IO thread writes, so no read-modify-write is needed
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /**
+     * Prints the counters and the throughput.
+     * @param name Name of the port printed in front.
+     * @param seconds Time the port was open, to calculate the throughput.
+     */
+    void print(std::ostream& out, const std::string& name, double seconds) const
+    {
+        double   perSecond = seconds > 0.0 ? 1.0 / seconds : 0.0;
+        uint64_t received  = framesReceived.load(std::memory_order_relaxed);
+        uint64_t sent      = framesSent.load(std::memory_order_relaxed);
+        out << name << ": received " << received << " frames (" << received * perSecond
+            << "/s, " << bytesReceived.load(std::memory_order_relaxed) * perSecond
+            << " B/s), lost " << framesLost.load(std::memory_order_relaxed) << ", late "
+            << framesLate.load(std::memory_order_relaxed) << ", crc errors "
+            << crcErrors.load(std::memory_order_relaxed) << ", sent " << sent << " frames ("
+            << sent * perSecond << "/s, " << bytesSent.load(std::memory_order_relaxed) * perSecond
+            << " B/s)" << std::endl;
+        writeLatency.print(out, name + " write latency");
+        roundTrip.print(out, name + " round trip");
+        oneWayJitter.print(out, name + " one-way jitter");
+    }
+};
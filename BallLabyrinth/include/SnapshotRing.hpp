@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Ring buffer of snapshots, which is allocated once at construction. Capturing a snapshot
+ * overwrites the oldest slot in place and never allocates.
+ * @tparam T Snapshot type, needs a member step with strictly increasing values.
+ */
+template<typename T>
+class SnapshotRing
+{
+private:
+    std::vector<T> slots; /**< Preallocated storage. */
+    size_t         next;  /**< Slot overwritten by the next capture. */
+    size_t         count; /**< Number of valid snapshots. */
+
+public:
+    /**
+     * Constructor allocating all slots.
+     * @param capacity Maximum number of snapshots kept.
+     */
+    explicit SnapshotRing(size_t capacity) : slots(capacity > 0 ? capacity : 1), next(0), count(0)
+    {
+    }
+
+    /**
+     * Returns the slot for a new snapshot, which becomes the newest one. The caller fills it in
+     * place.
+     */
+    T& capture()
+    {
+        T& slot = slots[next];
+        next    = (next + 1) % slots.size();
+        if (count < slots.size())
+            count++;
+        return slot;
+    }
+
+    size_t size() const { return count; }
+
+    size_t capacity() const { return slots.size(); }
+
+    /**
+     * Returns a snapshot by age.
+     * @param age 0 for the newest snapshot, size() - 1 for the oldest.
+     */
+    const T& at(size_t age) const { return slots[(next + slots.size() - 1 - age) % slots.size()]; }
+
+    /**
+     * Finds the newest snapshot which was captured at or before a step.
+     * @param step Requested step.
+     * @return Snapshot or nullptr, if all snapshots are newer.
+     */
+    const T* findAtOrBefore(uint64_t step) const
+    {
+        if (count == 0 || at(count - 1).step > step)
+            return nullptr;
+        // steps decrease with increasing age, search the youngest snapshot not newer than step
+        size_t low = 0, high = count - 1;
+        while (low < high)
+        {
+            size_t mid = (low + high) / 2;
+            if (at(mid).step <= step)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return &at(low);
+    }
+
+    /**
+     * Drops all snapshots newer than a step, e.g. after the simulation was rewound to it.
+     */
+    void discardAfter(uint64_t step)
+    {
+        while (count > 0 && at(0).step > step)
+        {
+            next = (next + slots.size() - 1) % slots.size();
+            count--;
+        }
+    }
+
+    void clear()
+    {
+        next  = 0;
+        count = 0;
+    }
+};
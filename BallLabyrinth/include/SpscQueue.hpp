@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * The storage is allocated inline, pushing and popping never allocate or block.
+ * @tparam T Trivially copyable element type.
+ * @tparam Capacity Number of slots, has to be a power of two.
+ */
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity has to be a power of two");
+
+private:
+    static const size_t mask = Capacity - 1;
+
+    alignas(64) std::atomic<size_t> head; /**< Next slot to read, written by the consumer only. */
+    alignas(64) std::atomic<size_t> tail; /**< Next slot to write, written by the producer only. */
+    alignas(64) T slots[Capacity];
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * Appends an element, called by the producer thread only.
+     * @param value Element to append.
+     * @return false if the queue is full, the element is dropped in that case.
+     */
+    bool push(const T& value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest element, called by the consumer thread only.
+     * @param value Receives the removed element.
+     * @return false if the queue was empty.
+     */
+    bool pop(T& value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Approximate number of queued elements, exact when called from producer or consumer while
+     * the other side is idle.
+     */
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "HandleProtocol.hpp"
+#include "HandleTransport.hpp"
+#include "LinkTracker.hpp"
+#include "SerialStats.hpp"
+
+#define UDP_JITTER_DELAY std::chrono::microseconds(2000) /**< Delay added by the jitter buffer. */
+#define UDP_JITTER_SLOTS 32 /**< Frames the jitter buffer holds at most. */
+#define UDP_DATAGRAM_SIZE 512 /**< Largest datagram received, holds several frames. */
+
+/**
+ * Connection to a handle behind a network bridge, e.g. a microcontroller board, which exchanges
+ * the frames of HandleProtocol in UDP datagrams, one or more frames per datagram.
+ *
+ * Datagrams may be lost, duplicated or reordered, so the received frames pass a jitter buffer:
+ * each frame is held until UDP_JITTER_DELAY after the time a frame of the fastest delay so far
+ * would have arrived, according to the device timestamps, and the frames are passed on in the
+ * order of their sequence numbers. Gaps in the sequence numbers passed on count as lost frames,
+ * frames arriving behind a newer frame which was passed on already are dropped as late.
+ *
+ * Frames are sent right away without a write queue, so write and send have to be called by the
+ * IO thread, as the servo loop of HandleInterface does.
+ */
+class UdpTransport : public HandleTransport
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Constructor, resolves the bridge and starts receiving.
+     * @throws boost::system::system_error if the host cannot be resolved.
+     */
+    UdpTransport(boost::asio::io_service& ioService,
+                 const std::string&       host,
+                 const std::string&       port,
+                 FrameCallback            readCallback,
+                 SerialStats&             stats)
+    : ioService(ioService)
+    , socket(ioService)
+    , playout(ioService)
+    , readCallback(readCallback)
+    , link(stats)
+    , stats(stats)
+    , writeSeq(0)
+    , buffered(0)
+    , delivered(false)
+    , lastDeliveredSeq(0)
+    {
+        boost::asio::ip::udp::resolver resolver(ioService);
+        boost::asio::ip::udp::endpoint bridge =
+            *resolver.resolve(boost::asio::ip::udp::resolver::query(host, port));
+        socket.open(bridge.protocol());
+        socket.connect(bridge);  // only datagrams of the bridge are received
+        socket.non_blocking(true);
+        receiveStart();
+    }
+
+    void write(double force) override
+    {
+        uint8_t frame[HandleProtocol::maxFrameSize];
+        auto    now = Clock::now();
+        sendFrame(frame,
+                  HandleProtocol::encodeValue(frame,
+                                              HandleProtocol::Force,
+                                              writeSeq,
+                                              static_cast<uint32_t>(LinkTracker::toUs(now)),
+                                              force),
+                  now);
+    }
+
+    bool send(HandleProtocol::FrameType type, const uint8_t* payload, size_t size) override
+    {
+        uint8_t frame[HandleProtocol::maxFrameSize];
+        auto    now = Clock::now();
+        if (size > HandleProtocol::maxPayload)
+            return false;
+        return sendFrame(frame,
+                         HandleProtocol::encode(frame,
+                                                type,
+                                                writeSeq,
+                                                static_cast<uint32_t>(LinkTracker::toUs(now)),
+                                                payload,
+                                                size),
+                         now);
+    }
+
+    void close() override
+    {
+        ioService.post(
+            boost::bind(&UdpTransport::doClose, this, boost::system::error_code()));
+    }
+
+private:
+    struct BufferedFrame  // received frame waiting in the jitter buffer
+    {
+        Clock::time_point due; /**< Time to pass the frame on. */
+        uint8_t           data[HandleProtocol::maxFrameSize];
+    };
+
+    static bool newer(uint16_t seq, uint16_t than)  // compares sequence numbers across wrap around
+    {
+        return static_cast<int16_t>(seq - than) > 0;
+    }
+
+    bool sendFrame(const uint8_t* frame, size_t size, Clock::time_point now)
+    {  // a datagram which does not fit into the socket buffer is dropped, as on the network
+        boost::system::error_code error;
+        size_t                    sent = socket.send(boost::asio::buffer(frame, size), 0, error);
+        link.frameSent(writeSeq++, now);
+        SerialStats::add(stats.framesSent, 1);
+        if (error)
+            return false;
+        SerialStats::add(stats.bytesSent, sent);
+        stats.writeLatency.record(Clock::now() - now);
+        return true;
+    }
+
+    void receiveStart()
+    {
+        socket.async_receive(boost::asio::buffer(datagram),
+                             boost::bind(&UdpTransport::receiveComplete,
+                                         this,
+                                         boost::asio::placeholders::error,
+                                         boost::asio::placeholders::bytes_transferred));
+    }
+
+    void receiveComplete(const boost::system::error_code& error, size_t bytes_transferred)
+    {
+        if (error == boost::asio::error::connection_refused)
+        {  // an earlier datagram found no bridge listening, it may not be started yet
+            receiveStart();
+            return;
+        }
+        if (error)
+        {
+            doClose(error);
+            return;
+        }
+        SerialStats::add(stats.bytesReceived, bytes_transferred);
+        auto now = Clock::now();
+        HandleProtocol::parse(
+            datagram,
+            bytes_transferred,
+            [this, now](const HandleProtocol::FrameView& frame) { frameReceived(frame, now); },
+            &parseStats);
+        stats.crcErrors.store(parseStats.crcErrors, std::memory_order_relaxed);
+        deliver(now);
+        receiveStart();
+    }
+
+    void frameReceived(const HandleProtocol::FrameView& frame, Clock::time_point now)
+    {  // hold a frame back for the delay the fastest frame had less, sorted by sequence number
+        int64_t delayUs = link.measureLatency(frame, now);
+        if (delivered && !newer(frame.seq(), lastDeliveredSeq))
+        {
+            SerialStats::add(stats.framesLate, 1);
+            return;
+        }
+        size_t slot = buffered;
+        while (slot > 0 && newer(bufferedSeq(slot - 1), frame.seq()))
+            slot--;
+        if (slot > 0 && bufferedSeq(slot - 1) == frame.seq())
+            return;  // duplicate
+        if (buffered == UDP_JITTER_SLOTS)
+        {  // the buffer overflows, so the oldest frame cannot wait any longer
+            pass(jitterBuffer[0]);
+            std::memmove(jitterBuffer, jitterBuffer + 1, --buffered * sizeof(BufferedFrame));
+            if (slot == 0)
+            {  // the frame is older than the one just passed on
+                SerialStats::add(stats.framesLate, 1);
+                return;
+            }
+            slot--;
+        }
+        std::memmove(jitterBuffer + slot + 1,
+                     jitterBuffer + slot,
+                     (buffered - slot) * sizeof(BufferedFrame));
+        buffered++;
+        auto hold = UDP_JITTER_DELAY - std::chrono::microseconds(delayUs);
+        jitterBuffer[slot].due = now + std::max<Clock::duration>(hold, Clock::duration::zero());
+        std::memcpy(jitterBuffer[slot].data, frame.bytes(), frame.size());
+    }
+
+    void deliver(Clock::time_point now)
+    {  // pass on the frames which are due, in order, and wait for the next one
+        size_t count = 0;
+        while (count < buffered && jitterBuffer[count].due <= now)
+            pass(jitterBuffer[count++]);
+        buffered -= count;
+        std::memmove(jitterBuffer, jitterBuffer + count, buffered * sizeof(BufferedFrame));
+        if (buffered == 0)
+            return;
+        playout.expires_at(jitterBuffer[0].due);
+        playout.async_wait(
+            boost::bind(&UdpTransport::playoutComplete, this, boost::asio::placeholders::error));
+    }
+
+    void playoutComplete(const boost::system::error_code& error)
+    {
+        if (!error && active)  // aborted whenever a received frame moves the playout time
+            deliver(Clock::now());
+    }
+
+    uint16_t bufferedSeq(size_t slot) const
+    {
+        return HandleProtocol::FrameView(jitterBuffer[slot].data).seq();
+    }
+
+    void pass(const BufferedFrame& entry)
+    {
+        HandleProtocol::FrameView frame(entry.data);
+        link.countSequence(frame.seq());
+        delivered        = true;
+        lastDeliveredSeq = frame.seq();
+        SerialStats::add(stats.framesReceived, 1);
+        readCallback(frame);
+    }
+
+    void doClose(const boost::system::error_code& error)
+    {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        playout.cancel(ignored);
+        active = false;
+    }
+
+    boost::asio::io_service&     ioService;
+    boost::asio::ip::udp::socket socket;  /**< Connected to the bridge. */
+    boost::asio::steady_timer    playout; /**< Expires when the next buffered frame is due. */
+    FrameCallback                readCallback;
+    LinkTracker                  link;
+    SerialStats&                 stats;
+    HandleProtocol::ParseStats   parseStats;
+    uint16_t                     writeSeq; /**< Sequence number of the next sent frame. */
+    uint8_t                      datagram[UDP_DATAGRAM_SIZE];    /**< Received datagram. */
+    BufferedFrame                jitterBuffer[UDP_JITTER_SLOTS]; /**< Sorted by sequence number. */
+    size_t                       buffered;         /**< Number of frames in jitterBuffer. */
+    bool                         delivered;        /**< lastDeliveredSeq is valid. */
+    uint16_t                     lastDeliveredSeq; /**< Sequence number of the last passed frame. */
+};
@@ -27,6 +27,7 @@
      * BALL_RADIUS)              /**< Ball mass for density of steel in gramm. */
 #define BALL_EPSILON 0.5         /**< Ball refraction material constant. */
 #define BALL_ROLL_FRICTION 0.001 /**< Ball roll friction constant. */
+#define UNDO_TIME 2.0            /**< Time in seconds the physics is rewound on undo. */
 
 
 int
@@ -90,7 +91,40 @@ showMessageBox(float elapsedTime)
 int
 main(int argc, char* argv[])
 {
-    assert(argc == 3);
+    assert(argc >= 3);
+
+    /** Optional arguments after the two handle devices. */
+    RealtimeScheduler::Config physicsRealtime; /**< Real-time setup of the physics thread. */
+    double servoRate = HANDLE_SERVO_RATE;      /**< Rate of the haptic servo loop in Hz. */
+    std::string recordPath; /**< File the handle samples and forces are recorded to. */
+    std::string telemetryPath; /**< File every servo tick is traced to. */
+    std::vector<HandleInterface::Device> handleDevices
+        = { { argv[1], 0 }, { argv[2], 1 } }; /**< Handle devices and their board axes. */
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--handle" && i + 3 < argc)
+        {
+            handleDevices.emplace_back(
+                argv[i + 1], std::stoul(argv[i + 2]), std::stod(argv[i + 3]));
+            i += 3;
+        }
+        else if (arg == "--realtime")
+            physicsRealtime.enabled = true;
+        else if (arg == "--cpu" && i + 1 < argc)
+            physicsRealtime.cpu = std::stoi(argv[++i]);
+        else if (arg == "--priority" && i + 1 < argc)
+            physicsRealtime.priority = std::stoi(argv[++i]);
+        else if (arg == "--servo-rate" && i + 1 < argc)
+            servoRate = std::stod(argv[++i]);
+        else if (arg == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--telemetry" && i + 1 < argc)
+            telemetryPath = argv[++i];
+        else
+            std::cout << "ignoring unknown argument " << arg << std::endl;
+    }
+
     SDL_Window*   mainwindow;  /**< Window handle. */
     SDL_GLContext maincontext; /**< Opengl context handle. */
 
@@ -151,7 +185,11 @@ main(int argc, char* argv[])
 
     /** Start Handle communication **/
 
-    HandleInterface    handleInterface(500000, std::string(argv[1]), std::string(argv[2]));
+    RealtimeScheduler::Config servoRealtime = physicsRealtime; /**< Servo thread is not pinned. */
+    servoRealtime.cpu                       = -1;
+
+    HandleInterface    handleInterface(
+        500000, handleDevices, servoRate, servoRealtime, recordPath, telemetryPath);
     HapticForceManager hapticForceManager(handleInterface);
     handleInterface.setHapticForceManager(&hapticForceManager);
 
@@ -160,7 +198,7 @@ main(int argc, char* argv[])
         SDL_Event event;
 
         /** Create physics object and add collision models. */
-        Physics physics(hapticForceManager, DELTA_TIME);
+        Physics physics(hapticForceManager, DELTA_TIME, physicsRealtime);
         physics.addBall(glMain.getScene()->getModelByName("Ball"),
                         BALL_MASS,
                         BALL_RADIUS,
@@ -189,11 +227,32 @@ main(int argc, char* argv[])
                                   std::ref(physics)); /**< Physics thread, calling the update
                                                          function of the physics object. */
 
+        bool goalReached = false; /**< Set as soon as the physics reports the goal trigger. */
+
         /** Game loop */
-        while (!quit && physics.inGame())
+        while (!quit && !goalReached)
         {
-            std::cout << "handle1: " << handleInterface.getPos1()
-                      << ", handle2: " << handleInterface.getPos2() << std::endl;
+            HandleInterface::HandleState handleState = handleInterface.getState();
+            /** React on trigger volumes the ball entered or left since the last frame. */
+            Physics::TriggerEvent triggerEvent;
+            while (physics.pollTriggerEvent(triggerEvent))
+            {
+                if (!triggerEvent.entered)
+                    continue;
+                switch (triggerEvent.type)
+                {
+                    case TriggerVolume::Goal:
+                        goalReached = true;
+                        break;
+                    case TriggerVolume::Hole:
+                        std::cout << "ball dropped into hole " << triggerEvent.id << std::endl;
+                        break;
+                    case TriggerVolume::Checkpoint:
+                        std::cout << "checkpoint " << triggerEvent.id << " reached" << std::endl;
+                        break;
+                }
+            }
+
             /** Update graphics model according to calculated positions and rotations of physics. */
             physics.updateGraphicsModel();
             /** Draw graphics object. */
@@ -225,8 +284,8 @@ main(int argc, char* argv[])
             quit = keyMap[SDLK_q];
 
 
-            xAxisRotation = -handleInterface.getPos1() / 3.0;
-            yAxisRotation = -handleInterface.getPos2() / 3.0;
+            xAxisRotation = -handleState.estimate[0].pos / 3.0;
+            yAxisRotation = -handleState.estimate[1].pos / 3.0;
 
             if (keyMap[SDLK_UP])
             {
@@ -265,11 +324,25 @@ main(int argc, char* argv[])
             }
 
             if (keyMap[SDLK_s] && !oldKeyMap[SDLK_s])
-                hapticForceManager.enableCenterSpring = !hapticForceManager.enableCenterSpring;
+                hapticForceManager.toggleConfig(&HapticConfig::enableCenterSpring);
             if (keyMap[SDLK_c] && !oldKeyMap[SDLK_c])
-                hapticForceManager.enableBallCollision = !hapticForceManager.enableBallCollision;
+                hapticForceManager.toggleConfig(&HapticConfig::enableBallCollision);
             if (keyMap[SDLK_w] && !oldKeyMap[SDLK_w])
-                hapticForceManager.enableWalls = !hapticForceManager.enableWalls;
+                hapticForceManager.toggleConfig(&HapticConfig::enableWalls);
+            if (keyMap[SDLK_p] && !oldKeyMap[SDLK_p])
+                hapticForceManager.toggleConfig(&HapticConfig::enablePrediction);
+            if (keyMap[SDLK_o] && !oldKeyMap[SDLK_o])
+                hapticForceManager.toggleConfig(&HapticConfig::enableOffload);
+            if (keyMap[SDLK_m] && !oldKeyMap[SDLK_m])
+                hapticForceManager.toggleConfig(&HapticConfig::enableContact);
+            if (keyMap[SDLK_g] && !oldKeyMap[SDLK_g])
+                hapticForceManager.toggleConfig(&HapticConfig::enableGuidance);
+            if (keyMap[SDLK_u] && !oldKeyMap[SDLK_u])
+            {
+                uint64_t undoSteps = static_cast<uint64_t>(UNDO_TIME / DELTA_TIME);
+                uint64_t step      = physics.getStepCount();
+                physics.rewind(step > undoSteps ? step - undoSteps : 0);
+            }
 
             glMain.resetModelRotationAroundAxis(0);
             glMain.resetModelRotationAroundAxis(1);
@@ -312,7 +385,10 @@ main(int argc, char* argv[])
 
         glMain.initializeNewLabyrinth(labyrinthObjFilePath, materialFolder);
     }
-    handleInterface.quit = true;
+    // the servo thread calls the haptic force manager every tick, so it has to end before the
+    // manager, which is destroyed first
+    handleInterface.setHapticForceManager(nullptr);
+    handleInterface.stop();
 
     /** Clear glMain */
     glMain.clearOpenGLSceneAndShaderProgram();
@@ -0,0 +1,111 @@
+/**
+ * Checks that the filter of the handles estimates the velocity of a known trajectory better than
+ * differencing the noisy samples, and that it starts over after a gap in the samples.
+ */
+
+#include "HandleEstimator.hpp"
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#define SAMPLE_DT 0.001    /**< Sample period of the handles in seconds. */
+#define NOISE 0.05         /**< Peak noise of the position samples. */
+#define SETTLE_SAMPLES 200 /**< Samples the filter is given to settle before errors count. */
+
+namespace
+{
+int failures = 0;
+
+void
+check(bool condition, const char* message)
+{
+    if (!condition)
+    {
+        std::cerr << message << std::endl;
+        failures++;
+    }
+}
+
+void
+checkVelocityError()
+{  // 0.5 Hz sine of amplitude 20, like a player moving the handle from stop to stop
+    const double    pi = std::acos(-1.0);
+    HandleEstimator estimator;
+    std::mt19937    random(1);
+    auto            now        = std::chrono::steady_clock::now();
+    double          previous   = 0.0;
+    double          filtered   = 0.0;
+    double          difference = 0.0;
+    int             count      = 0;
+    for (int i = 0; i < 5000; i++)
+    {
+        double t      = i * SAMPLE_DT;
+        double noise  = (static_cast<double>(random()) / random.max() - 0.5) * 2.0 * NOISE;
+        double sample = 20.0 * std::sin(pi * t) + noise;
+        double vel    = 20.0 * pi * std::cos(pi * t);
+        const HandleEstimate& estimate = estimator.update(sample, SAMPLE_DT, now);
+        if (i >= SETTLE_SAMPLES)
+        {
+            filtered += (estimate.vel - vel) * (estimate.vel - vel);
+            double differenced = (sample - previous) / SAMPLE_DT;
+            difference += (differenced - vel) * (differenced - vel);
+            count++;
+        }
+        previous = sample;
+    }
+    filtered   = std::sqrt(filtered / count);
+    difference = std::sqrt(difference / count);
+    if (filtered > 0.25 * difference)
+    {
+        std::cerr << "rms velocity error " << filtered << ", differencing " << difference
+                  << std::endl;
+        failures++;
+    }
+}
+
+void
+checkRamp()
+{  // without noise a constant velocity is tracked exactly once the filter settled
+    HandleEstimator estimator;
+    auto            now = std::chrono::steady_clock::now();
+    HandleEstimate  estimate;
+    for (int i = 0; i < 1000; i++)
+        estimate = estimator.update(5.0 * i * SAMPLE_DT, SAMPLE_DT, now);
+    check(std::abs(estimate.vel - 5.0) < 0.01, "velocity of a ramp not tracked");
+    check(std::abs(estimate.acc) < 0.1, "acceleration on a ramp");
+}
+
+void
+checkReset()
+{  // a gap longer than HANDLE_FILTER_RESET or a timestamp going back starts the filter over
+    HandleEstimator estimator;
+    auto            now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++)
+        estimator.update(5.0 * i * SAMPLE_DT, SAMPLE_DT, now);
+    HandleEstimate estimate = estimator.update(-3.0, 2.0 * HANDLE_FILTER_RESET, now);
+    check(estimate.pos == -3.0 && estimate.vel == 0.0 && estimate.acc == 0.0,
+          "filter not restarted after a gap in the samples");
+
+    for (int i = 0; i < 100; i++)
+        estimator.update(5.0 * i * SAMPLE_DT, SAMPLE_DT, now);
+    estimate = estimator.update(1.0, -SAMPLE_DT, now);
+    check(estimate.pos == 1.0 && estimate.vel == 0.0 && estimate.acc == 0.0,
+          "filter not restarted after a timestamp going back");
+
+    // after the restart the velocity is estimated anew
+    for (int i = 1; i < 1000; i++)
+        estimate = estimator.update(1.0 - 2.0 * i * SAMPLE_DT, SAMPLE_DT, now);
+    check(std::abs(estimate.vel + 2.0) < 0.01, "velocity not tracked after a restart");
+}
+}
+
+int
+main()
+{
+    checkVelocityError();
+    checkRamp();
+    checkReset();
+    if (failures == 0)
+        std::cout << "handle filter tracks the velocity and restarts after gaps" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/**
+ * Checks that a wall pushes the handles the same way, whether the ball collides with it or rests
+ * against it within the contact range.
+ */
+
+#include "HapticForceManager.hpp"
+#include <iostream>
+
+namespace
+{
+int failures = 0;
+
+void
+checkWall(const char* name, const StaticObject& wall, const glm::vec3& center)
+{
+    CollisionIndex walls;
+    walls.addWall(wall);
+    walls.build();
+
+    HapticForceManager::BallPose ball;
+    ball.valid       = true;
+    ball.centerpoint = center;
+    ball.radius      = 1.0f;
+    glm::vec2 contact = HapticForceManager::getContactForce(walls, ball, HapticConfig());
+
+    // collision of the same ball flying into the wall, resolved like Physics::Ball does
+    glm::vec3 normal
+        = glm::normalize(center - glm::clamp(center, wall.edgepointMin, wall.edgepointMax));
+    glm::vec3 velocity = -50.0f * normal;
+    float     j        = -1.5f * glm::dot(velocity, normal);
+    velocity += j * normal;
+    glm::vec2 collision = HapticForceManager::getCollisionForce(j * normal, velocity);
+
+    for (int axis = 0; axis < HANDLE_AXES; axis++)
+    {
+        if (sgn(contact[axis]) != sgn(collision[axis]))
+        {
+            std::cerr << name << ": handle " << axis + 1 << " contact force " << contact[axis]
+                      << ", collision force " << collision[axis] << std::endl;
+            failures++;
+        }
+    }
+    if (contact == glm::vec2(0.0f, 0.0f))
+    {
+        std::cerr << name << ": no contact force" << std::endl;
+        failures++;
+    }
+}
+}
+
+int
+main()
+{
+    // walls 1 cm thick, 2 cm high on a floor at 0, the ball 0.1 cm away from them
+    checkWall("wall left of the ball", StaticObject(0, 0, 0, 20, 0, 2, 1), glm::vec3(2.1f, 10, 1));
+    checkWall("wall right of the ball", StaticObject(5, 0, 5, 20, 0, 2, 1), glm::vec3(3.9f, 10, 1));
+    checkWall("wall below the ball", StaticObject(0, 0, 20, 0, 0, 2, 1), glm::vec3(10, 2.1f, 1));
+    checkWall("wall above the ball", StaticObject(0, 5, 20, 5, 0, 2, 1), glm::vec3(10, 3.9f, 1));
+    if (failures == 0)
+        std::cout << "wall contact and collision forces point the same way" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
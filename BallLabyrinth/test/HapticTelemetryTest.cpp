@@ -0,0 +1,128 @@
+/**
+ * Writes a telemetry trace the way the servo loop does and checks that HapticTelemetry::load reads
+ * back the same ticks, within the resolution of the format.
+ */
+
+#include "HapticTelemetry.hpp"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#define TRACE_PATH "HapticTelemetryTest.htel"
+#define TRACE_TICKS 1000
+
+namespace
+{
+int failures = 0;
+
+HapticSample
+makeSample(int tick)
+{  // smooth motion with a jump now and then, so the deltas take one and several bytes
+    HapticSample sample;
+    sample.timeUs    = 1000000000000LL + tick * 1000 + (tick % 7);
+    sample.lateUs    = (tick % 13) * 3 - 10;
+    sample.computeUs = 40 + tick % 5;
+    for (int axis = 0; axis < TELEMETRY_AXES; axis++)
+    {
+        sample.pos[axis] = 0.25f * std::sin(tick * 0.01f + axis) + (tick % 100 == 0 ? 1.0f : 0.0f);
+        sample.vel[axis] = 2.5f * std::cos(tick * 0.01f + axis);
+        sample.total[axis] = 0.0f;
+        for (int component = 0; component < HapticSample::ComponentCount; component++)
+        {
+            sample.force[component][axis] = 0.01f * (component + 1) * std::sin(tick * 0.1f - axis);
+            sample.total[axis] += sample.force[component][axis];
+        }
+    }
+    return sample;
+}
+
+void
+checkClose(int tick, const char* field, float expected, float loaded, double scale)
+{
+    if (std::abs(expected - loaded) > 0.5 / scale + 1e-6 * std::abs(expected))
+    {
+        std::cerr << "tick " << tick << ": " << field << " written " << expected << ", loaded "
+                  << loaded << std::endl;
+        failures++;
+    }
+}
+
+void
+checkSample(int tick, const HapticSample& expected, const HapticSample& loaded)
+{
+    if (expected.timeUs != loaded.timeUs || expected.lateUs != loaded.lateUs
+        || expected.computeUs != loaded.computeUs)
+    {
+        std::cerr << "tick " << tick << ": timing differs" << std::endl;
+        failures++;
+    }
+    for (int axis = 0; axis < TELEMETRY_AXES; axis++)
+    {
+        checkClose(tick, "pos", expected.pos[axis], loaded.pos[axis], TELEMETRY_MOTION_SCALE);
+        checkClose(tick, "vel", expected.vel[axis], loaded.vel[axis], TELEMETRY_MOTION_SCALE);
+        for (int component = 0; component < HapticSample::ComponentCount; component++)
+            checkClose(tick,
+                       "force",
+                       expected.force[component][axis],
+                       loaded.force[component][axis],
+                       TELEMETRY_FORCE_SCALE);
+        checkClose(tick, "total", expected.total[axis], loaded.total[axis], TELEMETRY_FORCE_SCALE);
+    }
+}
+
+void
+writeTrace(const std::vector<char>& data, size_t size)
+{
+    std::ofstream out(TRACE_PATH, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), size);
+}
+
+void
+check(bool condition, const char* message)
+{
+    if (!condition)
+    {
+        std::cerr << message << std::endl;
+        failures++;
+    }
+}
+}
+
+int
+main()
+{
+    HapticTelemetry telemetry;
+    check(telemetry.open(TRACE_PATH), "cannot create the trace");
+    for (int tick = 0; tick < TRACE_TICKS; tick++)
+        telemetry.push(makeSample(tick));
+    telemetry.close();
+    check(telemetry.getDropped() == 0, "ticks dropped while writing");
+
+    std::vector<HapticSample> samples;
+    check(HapticTelemetry::load(TRACE_PATH, samples), "cannot load the trace");
+    check(samples.size() == TRACE_TICKS, "wrong number of ticks loaded");
+    for (size_t tick = 0; tick < samples.size() && tick < TRACE_TICKS; tick++)
+        checkSample(tick, makeSample(tick), samples[tick]);
+
+    // a trace cut off while writing keeps its complete ticks
+    std::vector<char> data;
+    {
+        std::ifstream in(TRACE_PATH, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    writeTrace(data, data.size() - 1);
+    check(HapticTelemetry::load(TRACE_PATH, samples), "cannot load the cut off trace");
+    check(samples.size() == TRACE_TICKS - 1, "wrong number of ticks loaded from the cut off trace");
+
+    // anything else is rejected
+    data[0] = 'X';
+    writeTrace(data, data.size());
+    check(!HapticTelemetry::load(TRACE_PATH, samples), "file without the magic loaded");
+    std::remove(TRACE_PATH);
+
+    if (failures == 0)
+        std::cout << "telemetry trace read back as written" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
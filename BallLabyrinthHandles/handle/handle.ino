@@ -3,6 +3,20 @@
 
 #define SIZE 5
 #define RINGBUFFER_SIZE 3
+
+// framed protocol, see BallLabyrinth/include/HandleProtocol.hpp
+#define FRAME_SYNC0 0xA5
+#define FRAME_SYNC1 0x5A
+#define FRAME_HEADER_SIZE 10
+#define FRAME_CRC_SIZE 2
+#define FRAME_MAX_PAYLOAD 32
+#define FRAME_POSITION 'P'
+#define FRAME_FORCE 'F'
+#define FRAME_MODEL 'M'
+#define MODEL_WALLS 1
+#define MODEL_CENTER_SPRING 2
+#define FRAME_NO_ACK 0xFFFF
+#define TIMER0_SPEEDUP 64 // setPwmFrequency(5, 1) runs timer 0 and therefore micros() 64 times faster
 /*
     DECLARATION
 */
@@ -39,10 +53,30 @@ float rs = 0.073152;   //[m]
 float rh = 0.065659;   //[m]
 // Force output variables
 float force = 0;           // force at the handle
+float hostForce = 0;       // force streamed by the host
+
+// local force model uploaded by the host, rendered every loop, see HapticForceManager
+float wallMin = 0;
+float wallMax = 0;
+float wallK = 0;
+float centerSpringK = 0;
+float centerSpringDead = 0;
+uint8_t modelFlags = 0;
 float Tp = 0;              // torque of the motor pulley
 float duty = 0;            // duty cylce (between 0 and 255)
 unsigned int output = 0;    // output command to the motor
 
+// communication
+uint16_t txSeq = 0;        // sequence number of the next sent frame
+uint8_t rxFrame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE]; // frame being received
+uint8_t rxFill = 0;        // number of bytes of rxFrame received so far
+uint16_t ackSeq = 0;       // sequence number of the last valid frame received
+uint32_t ackTime = 0;      // time it was received
+boolean acked = false;     // a valid frame was received
+uint32_t clockUs = 0;      // device time in real microseconds, wraps at 2^32 like the host expects
+uint32_t clockMicros = 0;  // micros() when clockUs was last advanced
+uint8_t clockRemainder = 0; // sped up microseconds not converted into clockUs yet
+
 void setup() {
   // Set up Serial communication
   Serial.begin(500000);
@@ -50,6 +84,7 @@ void setup() {
     ; // wait for serial port to connect. Needed for native USB port only
   }
   setPwmFrequency(pwmPin, 1);
+  clockMicros = micros();
   // Input pins
   pinMode(sensorPosPin, INPUT); // set MR sensor pin to be an input
 
@@ -66,36 +101,129 @@ void setup() {
   lastRawPos = analogRead(sensorPosPin);
 }
 
-bool readForce()
+uint16_t crc16(const uint8_t* data, uint8_t size)
 {
-  int32_t forcei = 0;
-  if (Serial.available() < 4)
-    return false;
-  //char buffer[4];
-  //Serial.readBytes(buffer, 4);
-  // ((char*)&forcei)[3] = buffer[3];
-  // ((char*)&forcei)[2] = buffer[2];
-  // ((char*)&forcei)[1] = buffer[1];
-  // ((char*)&forcei)[0] = buffer[0];
-  ((char*)&forcei)[3] = Serial.read();
-  ((char*)&forcei)[2] = Serial.read();
-  ((char*)&forcei)[1] = Serial.read();
-  ((char*)&forcei)[0] = Serial.read();
-  force = (float)forcei / 1000000.0;
-  while (Serial.available() > 0)
-    Serial.read();
-  return true;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < size; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
 }
 
-void communication() {
-  if (readForce()) {
-    //int32_t forcei = force;// * 1000000;
-    int32_t xhi = xh * 1000000;
-    Serial.write((const char*)&xhi, 4);
-    Serial.flush();
+// micros() / TIMER0_SPEEDUP would wrap after 2^32 / 64 us already, so the real microseconds are
+// accumulated instead, carrying the remainder of the division
+uint32_t timestampUs()
+{
+  uint32_t now = micros();
+  uint32_t elapsed = now - clockMicros + clockRemainder;
+  clockMicros = now;
+  clockUs += elapsed / TIMER0_SPEEDUP;
+  clockRemainder = elapsed % TIMER0_SPEEDUP;
+  return clockUs;
+}
+
+// position frames echo the last received frame, so the host can measure the round trip time
+void sendPosition(float value)
+{
+  uint8_t frame[FRAME_HEADER_SIZE + 8 + FRAME_CRC_SIZE];
+  int32_t valuei = lround(value * 1000000.0);
+  uint32_t timestamp = timestampUs();
+  uint32_t ackDelay = timestamp - ackTime;
+  if (!acked)
+    ackDelay = FRAME_NO_ACK;
+  else if (ackDelay >= FRAME_NO_ACK)
+    ackDelay = FRAME_NO_ACK - 1;
+  frame[0] = FRAME_SYNC0;
+  frame[1] = FRAME_SYNC1;
+  frame[2] = FRAME_POSITION;
+  frame[3] = 8;
+  frame[4] = txSeq & 0xFF;
+  frame[5] = txSeq >> 8;
+  for (uint8_t i = 0; i < 4; i++) {
+    frame[6 + i] = (timestamp >> (8 * i)) & 0xFF;
+    frame[FRAME_HEADER_SIZE + i] = ((uint32_t)valuei >> (8 * i)) & 0xFF;
+  }
+  frame[FRAME_HEADER_SIZE + 4] = ackSeq & 0xFF;
+  frame[FRAME_HEADER_SIZE + 5] = ackSeq >> 8;
+  frame[FRAME_HEADER_SIZE + 6] = ackDelay & 0xFF;
+  frame[FRAME_HEADER_SIZE + 7] = ackDelay >> 8;
+  uint16_t crc = crc16(frame + 2, FRAME_HEADER_SIZE - 2 + 8);
+  frame[FRAME_HEADER_SIZE + 8] = crc & 0xFF;
+  frame[FRAME_HEADER_SIZE + 9] = crc >> 8;
+  txSeq++;
+  Serial.write(frame, sizeof(frame));
+}
+
+float readValue(uint8_t offset)
+{
+  int32_t valuei = (int32_t)((uint32_t)rxFrame[FRAME_HEADER_SIZE + offset]
+                             | ((uint32_t)rxFrame[FRAME_HEADER_SIZE + offset + 1] << 8)
+                             | ((uint32_t)rxFrame[FRAME_HEADER_SIZE + offset + 2] << 16)
+                             | ((uint32_t)rxFrame[FRAME_HEADER_SIZE + offset + 3] << 24));
+  return (float)valuei / 1000000.0;
+}
+
+void frameReceived()
+{
+  ackSeq = rxFrame[4] | (rxFrame[5] << 8);
+  ackTime = timestampUs();
+  acked = true;
+  if (rxFrame[2] == FRAME_FORCE && rxFrame[3] == 4) {
+    hostForce = readValue(0);
+  } else if (rxFrame[2] == FRAME_MODEL && rxFrame[3] >= 21) {
+    wallMin = readValue(0);
+    wallMax = readValue(4);
+    wallK = readValue(8);
+    centerSpringK = readValue(12);
+    centerSpringDead = readValue(16);
+    modelFlags = rxFrame[FRAME_HEADER_SIZE + 20];
   }
 }
 
+void receiveByte(uint8_t byte);
+
+// drops the first byte of a rejected frame and scans the rest again, like HandleProtocol::parse,
+// so a frame starting inside a corrupted one is not lost
+void resync()
+{
+  uint8_t fill = rxFill;
+  rxFill = 0;
+  for (uint8_t i = 1; i < fill; i++)
+    receiveByte(rxFrame[i]);  // only writes below i, so the bytes still to scan stay intact
+}
+
+// feeds a received byte into rxFrame, drops bytes until the sync bytes and a valid checksum are found
+void receiveByte(uint8_t byte)
+{
+  rxFrame[rxFill++] = byte;
+  if ((rxFill == 1 && byte != FRAME_SYNC0) || (rxFill == 2 && byte != FRAME_SYNC1)
+      || (rxFill == 4 && byte > FRAME_MAX_PAYLOAD)) {
+    resync();
+    return;
+  }
+  if (rxFill < 4 || rxFill < FRAME_HEADER_SIZE + rxFrame[3] + FRAME_CRC_SIZE)
+    return;
+  uint8_t payloadSize = rxFrame[3];
+  uint16_t crc = rxFrame[FRAME_HEADER_SIZE + payloadSize] | (rxFrame[FRAME_HEADER_SIZE + payloadSize + 1] << 8);
+  if (crc != crc16(rxFrame + 2, FRAME_HEADER_SIZE - 2 + payloadSize)) {
+    resync();
+    return;
+  }
+  frameReceived();
+  rxFill = 0;
+}
+
+void communication() {
+  // every received byte is consumed, partial frames continue in the next loop
+  while (Serial.available() > 0)
+    receiveByte(Serial.read());
+  // positions are streamed every loop, independent of the force commands
+  if (Serial.availableForWrite() >= FRAME_HEADER_SIZE + 8 + FRAME_CRC_SIZE)
+    sendPosition(xh);
+}
+
 void readPosCount() {
   // Get voltage output by MR sensor
   rawPos = analogRead(sensorPosPin);  //current raw position from MR sensor
@@ -141,6 +269,20 @@ void calPosMeter()
   vh = (xh - xh_prev) / .0001;
 }
 
+// adds the local force model to the streamed force
+void localForces()
+{
+  force = hostForce;
+  if (modelFlags & MODEL_WALLS) {
+    if (xh > wallMax)
+      force += wallK * (xh - wallMax);
+    else if (xh < wallMin)
+      force += wallK * (xh - wallMin);
+  }
+  if ((modelFlags & MODEL_CENTER_SPRING) && abs(xh) > centerSpringDead)
+    force += (xh - (xh > 0 ? centerSpringDead : -centerSpringDead)) * centerSpringK;
+}
+
 void motorControl()
 {
   Tp = rp / rs * rh * force;  // Compute the require motor pulley torque (Tp) to generate that force
@@ -199,6 +341,7 @@ void loop() {
   readPosCount();
   calPosMeter();
   communication();
+  localForces();
   motorControl();
   // delay before next reading:
   delay(1);